@@ -13,15 +13,62 @@
 #define true 1
 #endif
 
-// Default order is 4.
-#define LEAF_ORDER 32
 #define INTERNAL_ORDER 249
 
+// Order of an internal page in the compact layout.
+#define COMPACT_ORDER 497
+
+/* Set to 0 to write every internal page in the
+* wide layout.  Pages already compact are still read.
+*/
+#ifndef COMPACT_INTERNAL
+#define COMPACT_INTERNAL 1
+#endif
+
+/* Pages a file may hold while internal pages are
+* still made compact, short of 2^32 by room for the
+* pages a single change allocates.
+*/
+#define COMPACT_MAX_PAGES (UINT32_MAX - (1 << 20))
+
+/* Bytes of slots and values a leaf below the root
+* keeps at least; a leaf with less is merged with or
+* refilled from a neighbor.
+*/
+#define LEAF_MIN_USED (LEAF_DATA_SIZE / 2)
+
+// Most a single record takes in a leaf.
+#define LEAF_MAX_RECORD ((int)sizeof(slot_t) + LEAF_INLINE_MAX)
+
 // Minimum order is necessarily 3.  We set the maximum
 // order arbitrarily.  You may change the maximum order.
 #define MIN_ORDER 3
 #define MAX_ORDER 20
 
+// Keys left for the (vectorized) linear pass
+// at the end of an internal page binary search.
+#define SEARCH_WINDOW 16
+
+// Leaves a range scan requests ahead of itself.
+#define SCAN_PREFETCH 32
+
+// Optimistic attempts a reader makes before
+// falling back to shared latches.
+#define OPTIMISTIC_RETRIES 8
+
+// Percentage of each page filled by db_bulk_load
+// when the caller does not choose one.
+#define DEFAULT_FILL_FACTOR 90
+
+/* Percentage of the entries a split at the right
+* edge of the tree leaves on the left page, which
+* ascending keys will not come back to.
+*/
+#define APPEND_SPLIT_FILL 90
+
+// Deepest tree a descent path can record.
+#define MAX_HEIGHT 16
+
 // Constants for printing part or all of the GPL license.
 #define LICENSE_FILE "LICENSE.txt"
 #define LICENSE_WARRANTEE 0
@@ -83,19 +130,73 @@ struct Node
 	Queue next;
 };
 
-// GLOBALS.
+/* A record on its way into a leaf (see make_record):
+* its key, the length of its value and the bytes the
+* leaf stores for it, which are the value itself or,
+* for a long value, the number of the first of its
+* overflow pages.
+*/
+typedef struct
+{
+	int64_t key;
+	uint32_t length;
+	uint16_t size;
+	const char * data;
+	pagenum_t overflow;
+} record_t;
 
-/* The order determines the maximum and minimum
-* number of entries (keys and pointers) in any
-* node.  Every node has at most order - 1 keys and
-* at least (roughly speaking) half that number.
-* Every leaf has as many pointers to data as keys,
-* and every internal node has one more pointer
-* to a subtree than the number of keys.
-* This global variable is initialized to the
-* default value.
+/* Root-to-leaf path recorded by find_leaf.
+* pagenum[0] is the root and pagenum[depth - 1]
+* the leaf; index[i] is the slot of pagenum[i]
+* the descent followed (-1 for leftmost_child).
+* A writer descent (find_leaf_for_update) also keeps
+* the pages a change may still reach pinned and
+* exclusively latched in latched[], and the table's
+* root latch if the root itself may change, until
+* path_release.
+* append is set when the leaf split by an insert is
+* the rightmost one and the new record goes to its
+* end; the splits that follow up the path are then
+* at the right edge of their levels too.
+* Every key the leaf covers is below high
+* (INT64_MAX: no bound).
 */
-extern int order;
+typedef struct
+{
+	int depth;
+	pagenum_t pagenum[MAX_HEIGHT];
+	int index[MAX_HEIGHT];
+	int latched_depth;
+	page_t * latched[MAX_HEIGHT];
+	bool root_latched;
+	bool append;
+	int64_t high;
+} path_t;
+
+/* Position of an open range scan.
+* Until positioned is set no record was looked at.
+* Then leaf and index name the next record to return
+* (leaf 0 once the range is exhausted): index is the
+* slot next to last_key, the record returned last,
+* and last_key is used to find the position again if
+* the leaf changed between calls.
+* prefetched counts the leaves already requested
+* ahead of the scan.
+*/
+typedef struct
+{
+	int table_id;
+	int64_t begin;
+	int64_t end;
+	bool backward;
+	bool positioned;
+	pagenum_t leaf;
+	int index;
+	int64_t last_key;
+	int prefetched;
+} cursor_t;
+
+// GLOBALS.
 
 /* The queue is used to print the tree in
 * level order, starting from the root
@@ -124,48 +225,77 @@ Queue makequeue();
 void enqueue(pagenum_t new_node, Queue);
 pagenum_t dequeue(Queue);
 //int height( node * root );
-int path_to_root(pagenum_t child);
-void print_leaves(void);
-void print_tree(void);
+int path_to_root(int table_id, pagenum_t child);
+void print_leaves(int table_id);
+void print_tree(int table_id);
 //void find_and_print(int64_t key, bool verbose); 
 //void find_and_print_range(node * root, int range1, int range2, bool verbose); 
 //int find_range( node * root, int key_start, int key_end, bool verbose,
 //        int returned_keys[], void * returned_pointers[]); 
-pagenum_t find_leaf(int64_t key);
-int db_find(int64_t key, char*);
+int64_t node_key(page_t * page, int i);
+pagenum_t node_child(page_t * page, int i);
+int internal_search(page_t * page, int64_t key);
+int leaf_search(page_t * page, int64_t key);
+int find_leaf(int table_id, int64_t key, path_t * path, bool latched,
+			  page_t ** leaf, uint64_t * version);
+bool is_safe(int table_id, page_t * page, bool is_root, bool inserting, int size,
+			 int64_t low, int64_t high);
+page_t * find_leaf_for_update(int table_id, int64_t key, path_t * path,
+							  bool inserting, int size, bool optimistic);
+page_t * find_rightmost(int table_id, int64_t key, path_t * path, int size);
+void path_release(int table_id, path_t * path);
+void path_push(path_t * path, pagenum_t pagenum, int index);
+int db_find(int table_id, int64_t key, char*, int trx_id);
+int find_record(int table_id, int64_t key, char * ret_val);
+int db_find_many(int table_id, int64_t * keys, char ** values, int * results, int n,
+				 int trx_id);
+int prefetch_leaves(int table_id, int64_t key, bool backward);
+int db_scan(int table_id, cursor_t * cursor, int64_t begin, int64_t end, bool backward);
+int db_scan_next(cursor_t * cursor, int64_t * key, char * value);
+void db_scan_close(cursor_t * cursor);
 int cut(int length);
 
 // Insertion.
 
-record_t * make_record(int64_t key, char* value);
-page_t * make_node(void);
-page_t * make_leaf(void);
-int get_left_index(pagenum_t parent, pagenum_t left);
-int insert_into_leaf(pagenum_t leaf, record_t * record); //***
-int insert_into_leaf_after_splitting(pagenum_t leaf,
+int make_record(int table_id, record_t * new_record, int64_t key, char* value);
+page_t * make_node(int table_id, pagenum_t * pagenum);
+page_t * make_leaf(int table_id, pagenum_t * pagenum);
+int insert_into_leaf(page_t * leaf, record_t * record); //***
+int insert_into_leaf_after_splitting(int table_id, path_t * path, page_t * leaf,
 									 record_t * record);
 
 //////////
-int insert_into_node(pagenum_t, int, int64_t, pagenum_t);
-int insert_into_node_after_splitting(pagenum_t, int, int64_t, pagenum_t);
-int insert_into_parent(pagenum_t, pagenum_t, int64_t, pagenum_t);
-int insert_into_new_root(pagenum_t, int64_t, pagenum_t);
-int start_new_tree(record_t * pointer);
-int db_insert(int64_t key, char* value);
+int insert_into_node(page_t *, int, int64_t, pagenum_t);
+int insert_into_node_after_splitting(int, path_t *, page_t *, int, int64_t, pagenum_t);
+int insert_into_parent(int, path_t *, pagenum_t, int64_t, pagenum_t);
+int insert_into_new_root(int, pagenum_t, int64_t, pagenum_t);
+int start_new_tree(int table_id, record_t * pointer);
+int db_insert(int table_id, int64_t key, char* value, int trx_id);
+int insert_record(int table_id, int64_t key, char* value);
+int db_insert_batch(int table_id, int64_t * keys, char ** values, int n, int trx_id);
+int db_update(int table_id, int64_t key, char* value, int trx_id);
+int update_record(int table_id, int64_t key, char* value, char * old_value);
+int db_commit(void);
+
+// Bulk loading.
+
+int compare_entries(const void * a, const void * b);
+int64_t level_nodes(int64_t m, int target, int minimum);
+int level_share(int64_t m, int64_t nodes, int64_t i);
+int db_bulk_load(int table_id, int64_t * keys, char ** values, int n, int fill_factor);
 
 // Deletion.
 
-int get_neighbor_index(node * n);
-node * adjust_root(node * root);
-node * coalesce_nodes(node * root, node * n, node * neighbor,
-					  int neighbor_index, int k_prime);
-node * redistribute_nodes(node * root, node * n, node * neighbor,
-						  int neighbor_index,
-						  int k_prime_index, int k_prime);
-node * delete_entry(node * root, node * n, int key, void * pointer);
-node * delete(node * root, int key);
-
-void destroy_tree_nodes(node * root);
-node * destroy_tree(node * root);
+int get_neighbor_index(path_t * path);
+void remove_entry_from_node(page_t * n, int index);
+int adjust_root(int table_id, page_t * root);
+int coalesce_nodes(int table_id, path_t * path, page_t * n, page_t * neighbor,
+				   pagenum_t neighbor_num, int neighbor_index, int64_t k_prime);
+int redistribute_nodes(int table_id, path_t * path, page_t * n, page_t * neighbor,
+					   int neighbor_index,
+					   int k_prime_index, int64_t k_prime);
+int delete_entry(int table_id, path_t * path, page_t * n, int index);
+int db_delete(int table_id, int64_t key, int trx_id);
+int delete_record(int table_id, int64_t key, char * old_value);
 
 #endif /* __BPT_H__*/
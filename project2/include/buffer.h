@@ -0,0 +1,107 @@
+#ifndef __BUFFER_H__
+#define __BUFFER_H__
+#include <stdbool.h>
+#include <pthread.h>
+#include "page.h"
+
+// Number of frames used when init_db is given a non-positive count.
+#define DEFAULT_BUF_NUM 128
+
+// Operations grouped into one log commit.
+#define GROUP_COMMIT_SIZE 256
+
+/* Frames one operation may pin or dirty, at most:
+* a split or merge up a tree of ordinary height and
+* a value's overflow pages.
+*/
+#define OP_MAX_FRAMES 16
+
+// Dirty frames written back with one file_write_pages.
+#define FLUSH_BATCH 64
+
+// Period of the background flusher.
+#define FLUSH_INTERVAL_MS 100
+
+// Period of the background checkpoint.
+#define CHECKPOINT_INTERVAL_MS 5000
+
+// Pause before a background checkpoint tries commit_latch again.
+#define CHECKPOINT_RETRY_MS 1
+
+/* Control block of one buffer frame.
+* The page images themselves live in a separate
+* page-aligned array so that a page_t* handed out
+* by buf_get_page maps back to its control block
+* by index.
+* Frames are chained into a hash table keyed by
+* (table id, page number), which a cache hit walks
+* without the pool lock; pin_count is therefore
+* atomic.  Victims are picked with a clock:
+* is_referenced is set on every pin and cleared by
+* the clock hand.
+* A dirty frame is not written to the table until
+* its image has been committed to the log
+* (is_logged), so the table never holds changes a
+* crash could leave half applied.
+* rec_lsn is the lsn of the oldest logged image not
+* yet written to the table (0 if none): redo after a
+* crash has to start there for this page.
+* latch guards the page image: shared for readers,
+* exclusive for writers.  It is only taken on a
+* pinned frame, so a latched frame is never evicted.
+* is_flushing is set while the background flusher
+* writes a copy of the image and cleared by any
+* change to it, which keeps the frame dirty.
+* Each control block has cache lines of its own, so
+* pinning one frame does not disturb its neighbors.
+* is_busy is set while the frame is claimed by one
+* thread (see claim_frame): while its page is read
+* from disk or its image is logged or copied to be
+* written back.  That happens without the pool
+* lock, so anyone wanting the page in the meantime
+* waits on ready instead of pinning it.
+* is_reading marks a busy frame whose page is being
+* read ahead (see buf_prefetch): nobody waits for
+* read, the transfer in flight, while holding the
+* pool lock, and the first thread to find it done
+* publishes the frame.
+*/
+typedef struct buffer_t
+{
+	page_t* frame;
+	int table_id;
+	pagenum_t pagenum;
+	bool is_valid;
+	bool is_dirty;
+	bool is_logged;
+	bool is_flushing;
+	bool is_busy;
+	bool is_referenced;
+	bool is_reading;
+	uint64_t rec_lsn;
+	int pin_count;
+	pthread_rwlock_t latch;
+	pthread_cond_t ready;
+	uring_io_t read;
+	struct buffer_t* hash_next;
+} __attribute__((aligned(64))) buffer_t;
+
+int init_db(int num_buf);
+int shutdown_db(void);
+int close_table(int table_id);
+
+page_t* buf_get_page(int table_id, pagenum_t pagenum);
+void buf_put_page(page_t* page, bool is_dirty);
+void buf_latch_page(page_t* page, bool exclusive);
+void buf_unlatch_page(page_t* page);
+uint64_t buf_read_begin(page_t* page, bool latched);
+bool buf_read_valid(page_t* page, uint64_t version);
+void buf_read_end(page_t* page, bool latched);
+page_t* buf_alloc_page(int table_id, pagenum_t* pagenum);
+void buf_free_page(int table_id, pagenum_t pagenum);
+void buf_prefetch(int table_id, const pagenum_t* pages, int n);
+void buf_commit(void);
+void buf_begin_op(void);
+void buf_group_commit(void);
+void buf_checkpoint(int table_id);
+#endif
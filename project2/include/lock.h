@@ -0,0 +1,19 @@
+#ifndef __LOCK_H__
+#define __LOCK_H__
+#include <stdint.h>
+#include "trx.h"
+
+// Buckets of the record lock table.
+#define LOCK_HASH_SIZE 4096
+
+// Lock modes.
+#define LOCK_SHARED 0
+#define LOCK_EXCLUSIVE 1
+
+// Results of lock_acquire.
+#define LOCK_GRANTED 0
+#define LOCK_DEADLOCK 1
+
+int lock_acquire(trx_t* trx, int table_id, int64_t key, int mode);
+void lock_release_all(trx_t* trx);
+#endif
@@ -0,0 +1,106 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include "page.h"
+
+// Record types.
+#define LOG_PAGE 1
+#define LOG_COMMIT 2
+#define LOG_UPDATE 3
+#define LOG_CLR 4
+#define LOG_END 5
+#define LOG_CHECKPOINT 6
+
+// Size of the in-memory log tail written out on flush.
+#define LOG_BUFFER_SIZE (1 << 20)
+
+// Log written since the last checkpoint that triggers the next one.
+#define LOG_CHECKPOINT_SIZE (64 << 20)
+
+// Bytes at the start of a log file holding its master record.
+#define LOG_MASTER_SIZE 4096
+
+/* Every log record starts with this header.
+* lsn is the record's position in the log: the
+* record at file offset o has lsn
+* base_lsn + o - LOG_MASTER_SIZE, so lsns keep
+* growing across truncations.
+* A LOG_PAGE record is followed by the full
+* after-image of page `pagenum`; a LOG_COMMIT
+* record has no payload and makes every record
+* before it durable.  Page images are redone only
+* up to the last intact LOG_COMMIT.
+* LOG_UPDATE, LOG_CLR and LOG_END belong to
+* transaction trx_id and are chained backwards
+* through prev_lsn.  A LOG_UPDATE describes a change
+* to record `key` by its kind (op, one of UNDO_*)
+* and is followed by the value the record held
+* before, which is all a logical undo needs.  A
+* LOG_CLR marks the change before undo_next_lsn as
+* undone, so undo never repeats itself; LOG_END
+* closes the transaction.
+* A LOG_CHECKPOINT record is followed by a
+* log_checkpoint_t.
+* The checksum covers the header (with the checksum
+* field zeroed) and the payload, so a torn tail is
+* detected and ignored by recovery.
+*/
+typedef struct
+{
+	uint64_t lsn;
+	uint64_t prev_lsn;
+	uint64_t undo_next_lsn;
+	uint32_t type;
+	uint32_t size;
+	pagenum_t pagenum;
+	int32_t trx_id;
+	int32_t op;
+	int64_t key;
+	uint64_t checksum;
+} log_record_t;
+
+// A transaction with records in a log, and the span they cover.
+typedef struct
+{
+	int trx_id;
+	uint64_t first_lsn;
+	uint64_t last_lsn;
+} log_trx_t;
+
+/* Payload of a LOG_CHECKPOINT record, followed by
+* num_active log_trx_t.  redo_lsn is the oldest
+* logged change that may be missing from the table
+* file, where redo starts.
+*/
+typedef struct
+{
+	uint64_t redo_lsn;
+	int64_t num_active;
+} log_checkpoint_t;
+
+/* The master record at the start of the log file,
+* rewritten by every checkpoint.
+*/
+typedef struct
+{
+	uint64_t magic;
+	uint64_t base_lsn;
+	uint64_t checkpoint_lsn;
+} log_master_t;
+
+int log_open(int table_id, const char* table_path);
+void log_close(int table_id);
+uint64_t log_append_page(int table_id, pagenum_t pagenum, page_t* image);
+uint64_t log_append_update(int table_id, int trx_id, int op, int64_t key, const char* old_value);
+uint64_t log_append_clr(int table_id, int trx_id, uint64_t undo_next_lsn);
+void log_append_end(int table_id, int trx_id);
+bool log_first_active(int table_id, int* trx_id, uint64_t* last_lsn);
+int log_read(int table_id, uint64_t lsn, log_record_t* rec, char* value);
+bool log_pending(int table_id);
+uint64_t log_synced_lsn(int table_id);
+void log_commit(int table_id);
+int64_t log_size(int table_id);
+uint64_t log_checkpoint_lsn(int table_id);
+void log_checkpoint(int table_id, uint64_t redo_lsn);
+#endif
@@ -1,38 +1,83 @@
 #include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "uring.h"
 #ifndef __PAGE_H__
 #define __PAGE_H__
 typedef uint64_t pagenum_t;
 
-typedef struct
-{
-	int64_t key;
-	char value[120];
-}record_t;
+// Bytes of a tree page after its common header.
+#define LEAF_DATA_SIZE 3968
+
+// Longest value kept in the leaf itself.
+#define LEAF_INLINE_MAX 976
+
+// Longest value a record may hold.
+#define MAX_VALUE_SIZE 16384
 
+// Bytes of value carried by one overflow page.
+#define OVERFLOW_DATA_SIZE 4064
+
+/* Slot of one record in a leaf.  The slots sit in
+* key order at the front of the leaf's data and the
+* values they point to (offset and size, in data)
+* are packed at its end, growing down, so short
+* values take only the room they need.  Values are
+* stored without their terminating NUL.
+* length is the length of the whole value.  One of
+* more than LEAF_INLINE_MAX bytes is kept on a chain
+* of overflow pages and the leaf stores only the
+* number of the first of them.
+*/
 typedef struct
 {
 	int64_t key;
-	pagenum_t child;
-}branch_t;
+	uint16_t offset;
+	uint16_t size;
+	uint32_t length;
+} slot_t;
 
+/* lsn sits where it does in page_t, so recovery
+* reads the page lsn of any page the same way.
+*/
 typedef struct header
 {
 	pagenum_t free;
 	pagenum_t root;
 	pagenum_t num;
-	char reserved[4072];
+	uint64_t lsn;
+	char reserved[4064];
 } header_page_t;
 
 typedef struct page_t
 {
-	union
-	{
-		pagenum_t next_free;
-		pagenum_t parent;
-	};
+	/* Free pages only.  Pages in the tree do not
+	* record their parent: ancestors come from the
+	* path of the descent, so moving a child between
+	* internal pages never has to touch it.
+	*/
+	pagenum_t next_free;
 	int is_leaf;
 	int num_keys;
-	int reserved[26];
+	/* Bumped when a writer latches the page
+	* exclusively and again when it lets go, so it is
+	* odd exactly while the page is being changed.
+	* Optimistic readers compare it before and after
+	* reading instead of latching.
+	*/
+	uint64_t version;
+	/* lsn of the log record holding the latest image
+	* of the page.  Recovery only redoes an image
+	* newer than the page in the table.
+	*/
+	uint64_t lsn;
+	// Leaves only: offset in data of the lowest value.
+	uint32_t values_start;
+	// Internal pages only: the layout in use and its key base.
+	uint32_t is_compact;
+	int64_t key_base;
+	int reserved[18];
 	union
 	{
 		pagenum_t leftmost_child;
@@ -40,17 +85,117 @@ typedef struct page_t
 	};
 	union
 	{
-		branch_t branches[248];
-		record_t records[31];
+		/* Internal pages keep keys and child page numbers
+		* in separate arrays so a search only streams
+		* through contiguous keys.  children[i] is the
+		* subtree holding keys >= keys[i].
+		*/
+		struct
+		{
+			int64_t keys[248];
+			pagenum_t children[248];
+		};
+		/* The compact layout of an internal page
+		* (is_compact) stores key i as key_base +
+		* key_offsets[i] and the child page numbers in
+		* 32 bits, which holds twice as many entries.  A
+		* page is written in it whenever its keys span
+		* less than 2^32 and its children fit.
+		*/
+		struct
+		{
+			uint32_t key_offsets[496];
+			uint32_t narrow_children[496];
+		};
+		slot_t slots[LEAF_DATA_SIZE / sizeof(slot_t)];
+		char data[LEAF_DATA_SIZE];
 	};
 } page_t;
 
-int db;
-header_page_t* header;
+/* A page of a long value, chained to the page with
+* the next part of it.  It keeps the version and lsn
+* of page_t in place, as the buffer pool and the log
+* treat every page alike.
+*/
+typedef struct
+{
+	pagenum_t next;
+	int32_t unused[2];
+	uint64_t version;
+	uint64_t lsn;
+	char data[OVERFLOW_DATA_SIZE];
+} overflow_page_t;
+
+// Table ids run from 1 to MAX_TABLES.
+#define MAX_TABLES 128
+
+/* Storage backends a table can be opened with.
+* BACKEND_PREAD reads and writes pages with
+* pread/pwrite; BACKEND_MMAP maps the file and
+* copies pages in and out of the mapping, with
+* msync at commit; BACKEND_DIRECT opens the file
+* with O_DIRECT, bypassing the page cache, and
+* moves pages through an io_uring.  All of them sit
+* behind the file_* calls below.
+*/
+#define BACKEND_PREAD 0
+#define BACKEND_MMAP 1
+#define BACKEND_DIRECT 2
+
+/* Address space an mmap table maps.  Pages past it
+* go through pread/pwrite.
+*/
+#define MMAP_RESERVE ((size_t)1 << 40)
+
+// Least an mmap table's file is grown by at a time.
+#define MMAP_GROW ((off_t)1 << 24)
+
+/* An open table: its file and its header page.
+* header is read once by open_table and stays
+* resident; it reaches disk only through the log
+* and at checkpoints.
+* root_latch guards header->root: descents hold it
+* until the root page itself is latched.  Every
+* change of root also bumps root_version, which
+* optimistic descents check instead.  free and
+* num belong to the buffer pool and are only
+* changed under its lock.
+* rightmost is the leaf an insert last found at the
+* right edge of the tree (0 if none), a hint for
+* ascending keys that the tree layer validates.
+* A slot with fd < 0 is free.  Tables are opened
+* and closed while no operation runs on them.
+* An mmap table maps MMAP_RESERVE bytes of its
+* file at map; map_size is how much of that the
+* file covers, grown under map_lock.
+*/
+typedef struct
+{
+	int fd;
+	char* pathname;
+	header_page_t* header;
+	pthread_rwlock_t root_latch;
+	uint64_t root_version;
+	pagenum_t rightmost;
+	int backend;
+	char* map;
+	off_t map_size;
+	pthread_mutex_t map_lock;
+} table_t;
+
+extern table_t tables[MAX_TABLES + 1];
 
 int open_table(char* pathname);
-pagenum_t file_alloc_page();
-void file_free_page(pagenum_t pagenum);
-void file_read_page(pagenum_t pagenum, page_t * dest);
-void file_write_page(pagenum_t pagenum, const page_t* src);
+int open_table_backend(char* pathname, int backend);
+bool is_open_table(int table_id);
+void file_close_table(int table_id);
+pagenum_t file_alloc_page(int table_id);
+void file_read_page(int table_id, pagenum_t pagenum, page_t * dest);
+void file_write_page(int table_id, pagenum_t pagenum, const page_t* src);
+void file_read_pages(int table_id, const pagenum_t* pagenums, page_t** pages, uring_io_t** reads, int n);
+void file_wait_read(int table_id, uring_io_t* read);
+void file_reap_reads(int table_id);
+void file_write_pages(int table_id, const pagenum_t* pagenums, page_t** pages, int n);
+void file_sync(int table_id);
+void file_prefetch(int table_id, pagenum_t pagenum, int count);
 #endif
@@ -0,0 +1,65 @@
+#ifndef __TRX_H__
+#define __TRX_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Buckets of the active transaction table.
+#define TRX_HASH_SIZE 1024
+
+// Kinds of change recorded for undo.
+#define UNDO_INSERT 1
+#define UNDO_DELETE 2
+#define UNDO_UPDATE 3
+
+/* One change made by a transaction, with what it
+* takes to reverse it: the value a deleted or
+* updated record held before (NULL for an
+* insertion), owned by the entry.  lsn is the
+* LOG_UPDATE record that logged it.
+*/
+typedef struct
+{
+	uint64_t lsn;
+	int type;
+	int table_id;
+	int64_t key;
+	char* value;
+} undo_t;
+
+struct lock_t;
+
+/* An active transaction.
+* locks lists the record locks it holds, released
+* together when it ends (strict two-phase locking).
+* While it waits for a lock, wait_lock is that
+* request and the transaction sleeps on cond; both
+* belong to the lock table (see lock.c).
+* undo is kept in the order the changes were made
+* and applied backwards by trx_abort.  It is also
+* in the logs of the tables changed, for restart
+* recovery to roll back what a crash cut short.
+* A transaction is used by one thread at a time.
+*/
+typedef struct trx_t
+{
+	int id;
+	struct lock_t* locks;
+	struct lock_t* wait_lock;
+	pthread_cond_t cond;
+	int visited;
+	undo_t* undo;
+	int undo_len;
+	int undo_capacity;
+	struct trx_t* hash_next;
+} trx_t;
+
+int trx_begin(void);
+int trx_commit(int trx_id);
+int trx_abort(int trx_id);
+trx_t* trx_get(int trx_id);
+trx_t* trx_enter(int trx_id, trx_t* implicit);
+void trx_leave(trx_t* trx);
+void trx_add_undo(trx_t* trx, int type, int table_id, int64_t key, const char* value);
+void trx_recover(int table_id);
+#endif
@@ -0,0 +1,65 @@
+#ifndef __URING_H__
+#define __URING_H__
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+// Submission queue entries of a table's ring.
+#define URING_ENTRIES 64
+
+/* An io_uring instance, driven through the raw
+* system calls.  The rings are shared with the
+* kernel: the submission ring, the completion ring
+* and the submission entries are mapped from fd.
+* sq_lock serializes submitters and cq_lock the
+* reaping of completions, so threads keep adding
+* transfers while another waits for the device.
+* inflight counts transfers submitted but not yet
+* reaped, never more than entries, so the
+* completion ring cannot overflow.
+* fd < 0 if the kernel refused to set one up.
+*/
+typedef struct
+{
+	int fd;
+	unsigned entries;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	unsigned inflight;
+	pthread_mutex_t sq_lock;
+	pthread_mutex_t cq_lock;
+} uring_t;
+
+/* One page-sized transfer.  done is set, once
+* the page is in place, by whichever thread reaps
+* its completion; the owner must keep the
+* transfer around until then.
+*/
+typedef struct
+{
+	void* buf;
+	off_t offset;
+	int fd;
+	bool write;
+	int done;
+} uring_io_t;
+
+int uring_init(uring_t* ring, unsigned entries);
+void uring_exit(uring_t* ring);
+void uring_submit(uring_t* ring, int fd, bool write, uring_io_t** ios, int n);
+void uring_reap(uring_t* ring);
+void uring_wait(uring_t* ring, uring_io_t* io);
+void uring_rw(uring_t* ring, int fd, bool write, uring_io_t* ios, int n);
+#endif
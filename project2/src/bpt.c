@@ -54,22 +54,15 @@
 
 #include "bpt.h"
 #include "page.h"
+#include "buffer.h"
+#include "lock.h"
 #include <string.h>
 #include <inttypes.h>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
 // GLOBALS.
 
-/* The order determines the maximum and minimum
-* number of entries (keys and pointers) in any
-* node.  Every node has at most order - 1 keys and
-* at least (roughly speaking) half that number.
-* Every leaf has as many pointers to data as keys,
-* and every internal node has one more pointer
-* to a subtree than the number of keys.
-* This global variable is initialized to the
-* default value.
-*/
-int order = LEAF_ORDER;
-
 /* The queue is used to print the tree in
 * level order, starting from the root
 * printing each entire rank on a separate
@@ -145,7 +138,7 @@ void print_license(int license_part)
 */
 void usage_1(void)
 {
-	printf("B+ Tree of Order %d.\n", order);
+	printf("B+ Tree of Order %d.\n", INTERNAL_ORDER);
 	printf("Following Silberschatz, Korth, Sidarshan, Database Concepts, "
 		   "5th ed.\n\n"
 		   "To build a B+ tree of a different order, start again and enter "
@@ -233,35 +226,52 @@ pagenum_t dequeue(Queue queue)
 * of the tree (with their respective
 * pointers, if the verbose_output flag is set.
 */
-void print_leaves(void)
+void print_leaves(int table_id)
 {
-	int i;
-	file_read_page(0, (page_t*)header);
-	pagenum_t start = header->root;
-
-	if ( !start )
+	int i, prefetched = 0;
+	int64_t first_key = 0;
+	pagenum_t now;
+	page_t* page, * next;
+
+	pthread_rwlock_rdlock(&tables[table_id].root_latch);
+	now = tables[table_id].header->root;
+	if ( !now )
 	{
+		pthread_rwlock_unlock(&tables[table_id].root_latch);
 		printf("Empty Tree.\n");
 		return;
 	}
-	page_t* page = (page_t*)malloc(sizeof(page_t));
-	file_read_page(start, page);
-	pagenum_t now = start;
+	page = buf_get_page(table_id, now);
+	buf_latch_page(page, false);
+	pthread_rwlock_unlock(&tables[table_id].root_latch);
 	while ( page->is_leaf != 1 )
 	{
 		now = page->leftmost_child;
-		file_read_page(page->leftmost_child, page);
+		next = buf_get_page(table_id, now);
+		buf_latch_page(next, false);
+		buf_unlatch_page(page);
+		buf_put_page(page, false);
+		page = next;
 	}
+	buf_unlatch_page(page);
+	buf_put_page(page, false);
 
 	while ( now )
 	{
-		file_read_page(now, page);
+		page = buf_get_page(table_id, now);
+		buf_latch_page(page, false);
 		for ( i = 0; i < page->num_keys; i++ )
 		{
-			printf("%"PRId64" ", page->records[i].key);
+			printf("%"PRId64" ", page->slots[i].key);
 		}
 		printf(" | ");
 		now = page->right_sibling;
+		if ( page->num_keys > 0 )
+			first_key = page->slots[0].key;
+		buf_unlatch_page(page);
+		buf_put_page(page, false);
+		if ( --prefetched <= SCAN_PREFETCH / 2 && now )
+			prefetched = prefetch_leaves(table_id, first_key, false);
 	}
 	printf("\n");
 }
@@ -284,30 +294,47 @@ return h;
 
 /* Utility function to give the length in edges
 * of the path from any node to the root.
+* Pages do not point up to their parents, so the
+* path is found by descending from the root with
+* the first key of the target's leftmost leaf,
+* which routes to every page on the way down to it.
 */
-int path_to_root(pagenum_t target)
+int path_to_root(int table_id, pagenum_t target)
 {
 	int length = 0;
+	int64_t key = 0;
+	pagenum_t now = target;
+	page_t* page;
 
-	file_read_page(0, (page_t*)header);
-	pagenum_t root_page = header->root;
-
-	page_t* page = (page_t*)malloc(sizeof(page_t));
-	file_read_page(target, page);
-
-	pagenum_t parent_page = page->parent;
-	if ( !parent_page )
+	for ( ;; )
 	{
-		return 0;
+		page = buf_get_page(table_id, now);
+		buf_latch_page(page, false);
+		if ( page->is_leaf )
+		{
+			if ( page->num_keys > 0 )
+				key = page->slots[0].key;
+			buf_unlatch_page(page);
+			buf_put_page(page, false);
+			break;
+		}
+		now = page->leftmost_child;
+		buf_unlatch_page(page);
+		buf_put_page(page, false);
 	}
-	while ( parent_page != root_page )
+
+	now = tables[table_id].header->root;
+	while ( now != target && now != 0 )
 	{
-		file_read_page(parent_page, page);
-		parent_page = page->parent;
+		page = buf_get_page(table_id, now);
+		buf_latch_page(page, false);
+		now = page->is_leaf ? 0 : node_child(page, internal_search(page, key));
+		buf_unlatch_page(page);
+		buf_put_page(page, false);
 		length++;
 	}
 
-	return length + 1;
+	return length;
 }
 
 
@@ -320,7 +347,7 @@ int path_to_root(pagenum_t target)
 * to the keys also appear next to their respective
 * keys, in hexadecimal notation.
 */
-void print_tree(void)
+void print_tree(int table_id)
 {
 
 	int i = 0;
@@ -330,9 +357,7 @@ void print_tree(void)
 
 	Queue queue = NULL;
 
-	file_read_page(0, (page_t*)header);
-
-	if ( header->root == 0 )
+	if ( tables[table_id].header->root == 0 )
 	{
 		printf("Empty tree.\n");
 		return;
@@ -340,21 +365,25 @@ void print_tree(void)
 
 	queue = makequeue();
 
-	enqueue(header->root, queue);
-	page_t* page = (page_t*)malloc(sizeof(page_t));
+	enqueue(tables[table_id].header->root, queue);
 
 	while ( queue->next != NULL )
 	{
 		pagenum_t now = dequeue(queue);
 
-		file_read_page(now, page);
-
-		new_rank = path_to_root(now);
+		/* Pages are latched one at a time, so the
+		* picture is only consistent while no writer
+		* runs.
+		*/
+		new_rank = path_to_root(table_id, now);
 		if ( new_rank != rank )
 		{
 			rank = new_rank;
 			printf("\n");
 		}
+
+		page_t* page = buf_get_page(table_id, now);
+		buf_latch_page(page, false);
 		if ( !page->is_leaf )
 		{
 			enqueue(page->leftmost_child, queue);
@@ -364,17 +393,20 @@ void print_tree(void)
 		{
 			if ( page->is_leaf )
 			{
-				printf("%"PRId64" ", page->records[i].key);
+				printf("%"PRId64" ", page->slots[i].key);
 			}
 			else
 			{
-				printf("%"PRId64" ", page->branches[i].key);
-				enqueue(page->branches[i].child, queue);
+				printf("%"PRId64" ", node_key(page, i));
+				enqueue(node_child(page, i), queue);
 			}
 		}
+		buf_unlatch_page(page);
+		buf_put_page(page, false);
 		printf(" | ");
 	}
 	printf("\n");
+	free(queue);
 
 	/*if (verbose_output)
 	printf("(%lx)", (unsigned long)n);
@@ -397,518 +429,2409 @@ void print_tree(void)
 }
 
 
-/* Traces the path from the root to a leaf, searching
-* by key.  Displays information about the path
-* if the verbose flag is set.
-* Returns the leaf containing the given key.
+/* Counts the keys among the n ascending keys
+* that are <= key.  Vectorized when the build
+* targets AVX2 or SSE4.2 (-mavx2 / -msse4.2),
+* scalar otherwise.
 */
-pagenum_t find_leaf(int64_t key)
+static int count_le(const int64_t * keys, int n, int64_t key)
 {
-	int i = 0;
-	pagenum_t pagenum = 0;
-
-	file_read_page(0, (page_t*)header);
-	pagenum_t root_page = header->root;
-	if ( root_page == 0 )
+	int i = 0, count = 0;
+#if defined(__AVX2__)
+	__m256i k = _mm256_set1_epi64x(key);
+	for ( ; i + 4 <= n; i += 4 )
 	{
-		printf("Empty tree.\n");
-		return 0;
+		__m256i v = _mm256_loadu_si256((const __m256i*)(keys + i));
+		int gt = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k)));
+		count += 4 - __builtin_popcount(gt);
 	}
-	page_t* page = (page_t*)malloc(sizeof(page_t));
-	file_read_page(root_page, page);
-	pagenum = root_page;
-	while ( !page->is_leaf )
+#elif defined(__SSE4_2__)
+	__m128i k = _mm_set1_epi64x(key);
+	for ( ; i + 2 <= n; i += 2 )
 	{
-		i = page->num_keys - 1;
-		while ( i >= 0 )
-		{
-			if ( page->branches[i].key > key ) i--;
-			else break;
-		}
-		if ( i == -1 )
-		{
-			pagenum = page->leftmost_child;
-			file_read_page(pagenum, page);
-		}
-		else
-		{
-			pagenum = page->branches[i].child;
-			file_read_page(pagenum, page);
-		}
+		__m128i v = _mm_loadu_si128((const __m128i*)(keys + i));
+		int gt = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, k)));
+		count += 2 - __builtin_popcount(gt);
+	}
+#endif
+	for ( ; i < n; i++ )
+	{
+		count += keys[i] <= key;
 	}
-	return pagenum;
+	return count;
 }
 
-/* Finds and returns the record to which
-* a key refers.
+// INTERNAL PAGES
+
+/* Counts the offsets among the n ascending 32-bit
+* offsets of a compact page that are <= offset, the
+* same way count_le does for full keys.
 */
-int db_find(int64_t key, char * ret_val)
+static int count_le32(const uint32_t * offsets, int n, uint32_t offset)
 {
-	int i = 0;
-
-	pagenum_t finded_leafpage = find_leaf(key);
+	int i = 0, count = 0;
+#if defined(__AVX2__)
+	__m256i sign = _mm256_set1_epi32(INT32_MIN);
+	__m256i k = _mm256_xor_si256(_mm256_set1_epi32((int)offset), sign);
+	for ( ; i + 8 <= n; i += 8 )
+	{
+		__m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(offsets + i)), sign);
+		int gt = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k)));
+		count += 8 - __builtin_popcount(gt);
+	}
+#elif defined(__SSE4_2__)
+	__m128i sign = _mm_set1_epi32(INT32_MIN);
+	__m128i k = _mm_xor_si128(_mm_set1_epi32((int)offset), sign);
+	for ( ; i + 4 <= n; i += 4 )
+	{
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(offsets + i)), sign);
+		int gt = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k)));
+		count += 4 - __builtin_popcount(gt);
+	}
+#endif
+	for ( ; i < n; i++ )
+	{
+		count += offsets[i] <= offset;
+	}
+	return count;
+}
 
-	page_t* page = (page_t*)malloc(sizeof(page_t));
+// Key i of an internal page, in either layout.
+int64_t node_key(page_t * page, int i)
+{
+	if ( page->is_compact )
+		return (int64_t)((uint64_t)page->key_base + page->key_offsets[i]);
+	return page->keys[i];
+}
 
-	if ( finded_leafpage == 0 ) return 1;
+/* Child of an internal page at slot i (-1:
+* leftmost_child).  A reader without a latch may
+* see the layout change under it, so i is kept
+* inside the wide array; validation discards
+* whatever it read.
+*/
+pagenum_t node_child(page_t * page, int i)
+{
+	if ( i == -1 )
+		return page->leftmost_child;
+	if ( page->is_compact )
+		return page->narrow_children[i];
+	return page->children[i < INTERNAL_ORDER - 1 ? i : INTERNAL_ORDER - 2];
+}
 
-	file_read_page(finded_leafpage, page);
+// True if keys from low to high fit one compact page.
+static bool key_span_fits(int64_t low, int64_t high)
+{
+	return (uint64_t)high - (uint64_t)low <= UINT32_MAX;
+}
 
+/* Copies the n keys and children of an internal page
+* to keys and children, leftmost_child aside, and
+* returns n.  Changes to internal pages are made on
+* such copies and written back with node_pack, which
+* picks the layout again.
+*/
+static int node_unpack(page_t * page, int64_t * keys, pagenum_t * children)
+{
+	int i;
 	for ( i = 0; i < page->num_keys; i++ )
 	{
-		if ( page->records[i].key == key )
-		{
-			strcpy(ret_val, page->records[i].value);
-			return 0;
-		}
+		keys[i] = node_key(page, i);
+		children[i] = node_child(page, i);
 	}
-	return 1;
+	return page->num_keys;
 }
 
-/* Finds the appropriate place to
-* split a node that is too big into two.
+/* True if n keys and children can be written in the
+* compact layout.
 */
-int cut(int length)
+static bool compact_fits(const int64_t * keys, const pagenum_t * children, int n)
 {
-	if ( length % 2 == 0 )
-		return length / 2;
-	else
-		return length / 2 + 1;
+	int i;
+	if ( !COMPACT_INTERNAL || n > COMPACT_ORDER - 1 )
+		return false;
+	if ( n > 0 && !key_span_fits(keys[0], keys[n - 1]) )
+		return false;
+	for ( i = 0; i < n; i++ )
+	{
+		if ( children[i] > UINT32_MAX )
+			return false;
+	}
+	return true;
 }
 
-
-// INSERTION
-
-/* Creates a new record to hold the value
-* to which a key refers.
+/* Writes n keys and children to an internal page,
+* compact if they fit, wide otherwise.  The callers
+* never pass more than a wide page holds unless they
+* know the entries fit the compact layout.
 */
-record_t * make_record(int64_t key, char* value)
+static void node_pack(page_t * page, const int64_t * keys, const pagenum_t * children, int n)
 {
-	record_t * new_record = (record_t *)malloc(sizeof(record_t));
-	if ( new_record == NULL )
+	int i;
+	if ( compact_fits(keys, children, n) )
 	{
-		perror("Record creation.");
-		exit(EXIT_FAILURE);
+		page->is_compact = true;
+		page->key_base = n > 0 ? keys[0] : 0;
+		for ( i = 0; i < n; i++ )
+		{
+			page->key_offsets[i] = (uint32_t)((uint64_t)keys[i] - (uint64_t)page->key_base);
+			page->narrow_children[i] = (uint32_t)children[i];
+		}
 	}
 	else
 	{
-		new_record->key = key;
-		strcpy(new_record->value, value);
+		if ( n > INTERNAL_ORDER - 1 )
+		{
+			fprintf(stderr, "Internal page overflow.\n");
+			exit(EXIT_FAILURE);
+		}
+		page->is_compact = false;
+		page->key_base = 0;
+		memcpy(page->keys, keys, sizeof(int64_t) * n);
+		memcpy(page->children, children, sizeof(pagenum_t) * n);
 	}
-	return new_record;
+	page->num_keys = n;
 }
 
-
-/* Creates a new general node, which can be adapted
-* to serve as either a leaf or an internal node.
+/* True if an internal page can take one more key,
+* known to lie between low and high, and a newly
+* allocated child without splitting: a wide page
+* while it is not full, a compact one while the key
+* keeps its span under 2^32 and the file is small
+* enough for the child.  A page that can take it
+* either way may change layout doing so.
 */
-page_t * make_node(void)
+static bool node_has_room(int table_id, page_t * page, int64_t low, int64_t high)
 {
-	page_t * new_node = (page_t*)malloc(sizeof(page_t));
-
-	if ( new_node == NULL )
-	{
-		perror("Node creation.");
-		exit(EXIT_FAILURE);
-	}
-
-	memset(new_node, 0, sizeof(page_t));
-	return new_node;
+	int n = page->num_keys;
+	if ( n < INTERNAL_ORDER - 1 )
+		return true;
+	if ( !page->is_compact || n >= COMPACT_ORDER - 1
+		 || tables[table_id].header->num >= COMPACT_MAX_PAGES )
+		return false;
+	if ( low > page->key_base )
+		low = page->key_base;
+	if ( high < node_key(page, n - 1) )
+		high = node_key(page, n - 1);
+	return key_span_fits(low, high);
 }
 
-/* Creates a new leaf by creating a node
-* and then adapting it appropriately.
+/* Replaces key index of an internal page, if the
+* page can hold the new key there: always, unless
+* it is compact, too full to turn wide, and the key
+* would stretch its span past 2^32.  Returns true if
+* the key was replaced.
 */
-page_t * make_leaf(void)
+static bool node_set_key(page_t * page, int index, int64_t key)
 {
-	page_t * leaf = make_node();
-	leaf->is_leaf = true;
-	return leaf;
+	int64_t keys[COMPACT_ORDER];
+	pagenum_t children[COMPACT_ORDER];
+	int n = node_unpack(page, keys, children);
+	int64_t low = index == 0 ? key : keys[0];
+	int64_t high = index == n - 1 ? key : keys[n - 1];
+	if ( page->is_compact && n > INTERNAL_ORDER - 1 && !key_span_fits(low, high) )
+		return false;
+	keys[index] = key;
+	node_pack(page, keys, children, n);
+	return true;
 }
 
+/* Returns num_keys clamped to what the page can
+* hold.  A page read optimistically may be changing
+* underneath the reader; clamping keeps the read
+* inside the page, and validation discards whatever
+* it found.
+*/
+static int safe_num_keys(page_t * page)
+{
+	int n = page->num_keys;
+	int capacity = page->is_leaf ? (int)(LEAF_DATA_SIZE / sizeof(slot_t))
+				   : page->is_compact ? COMPACT_ORDER - 1 : INTERNAL_ORDER - 1;
+	if ( n < 0 )
+		return 0;
+	return n > capacity ? capacity : n;
+}
 
-/* Helper function used in insert_into_parent
-* to find the index of the parent's pointer to
-* the node to the left of the key to be inserted.
+/* Returns the slot of an internal page to follow
+* for key: -1 for leftmost_child, otherwise the
+* last i with keys[i] <= key.
+* Binary search narrows the range to SEARCH_WINDOW
+* keys, which are then compared all at once.  A
+* compact page is searched on its offsets, once key
+* is known to fall within their span.
 */
-int get_left_index(pagenum_t parent_num, pagenum_t left_num)
+int internal_search(page_t * page, int64_t key)
 {
+	int lo = 0, hi = safe_num_keys(page), mid;
+	uint32_t offset;
 
-	int left_index = 0;
-	page_t* parent = (page_t*)malloc(sizeof(page_t));
-	file_read_page(parent_num, parent);
-	if ( parent->leftmost_child == left_num ) return 0;
-	while ( left_index < parent->num_keys &&
-		   parent->branches[left_index].child != left_num )
+	if ( page->is_compact )
+	{
+		if ( key < page->key_base )
+			return -1;
+		if ( !key_span_fits(page->key_base, key) )
+			return hi - 1;
+		offset = (uint32_t)((uint64_t)key - (uint64_t)page->key_base);
+		while ( hi - lo > SEARCH_WINDOW )
+		{
+			mid = (lo + hi) / 2;
+			if ( page->key_offsets[mid] <= offset ) lo = mid + 1;
+			else hi = mid;
+		}
+		return lo + count_le32(page->key_offsets + lo, hi - lo, offset) - 1;
+	}
+	while ( hi - lo > SEARCH_WINDOW )
 	{
-		left_index++;
+		mid = (lo + hi) / 2;
+		if ( page->keys[mid] <= key ) lo = mid + 1;
+		else hi = mid;
 	}
-	return left_index + 1;
+	return lo + count_le(page->keys + lo, hi - lo, key) - 1;
 }
 
-/* Inserts a new pointer to a record and its corresponding
-* key into a leaf.
-* Returns the altered leaf.
+/* Returns the index of the first record of a
+* leaf whose key is >= key (num_keys if none).
 */
-int insert_into_leaf(pagenum_t leaf_page, record_t * pointer)
+int leaf_search(page_t * page, int64_t key)
 {
-
-	int i, insertion_point;
-	page_t* page = (page_t*)malloc(sizeof(page_t));
-	file_read_page(leaf_page, page);
-
-	insertion_point = 0;
-	while ( insertion_point < page->num_keys && page->records[insertion_point].key < pointer->key )
-		insertion_point++;
-
-	for ( i = page->num_keys; i > insertion_point; i-- )
+	int lo = 0, hi = safe_num_keys(page), mid;
+	while ( lo < hi )
 	{
-		page->records[i].key = page->records[i - 1].key;
-		strcpy(page->records[i].value, page->records[i - 1].value);
+		mid = (lo + hi) / 2;
+		if ( page->slots[mid].key < key ) lo = mid + 1;
+		else hi = mid;
 	}
-	page->records[insertion_point].key = pointer->key;
-	strcpy(page->records[insertion_point].value, pointer->value);
-	page->num_keys++;
-	file_write_page(leaf_page, page);
-	return 0;
+	return lo;
 }
 
+// LEAF RECORDS
 
-/* Inserts a new key and pointer
-* to a new record into a leaf so as to exceed
-* the tree's order, causing the leaf to be split
-* in half.
-*/
-int insert_into_leaf_after_splitting(pagenum_t leaf_page, record_t * pointer)
+// Bytes of slots and values in use in a leaf.
+static int leaf_used(page_t * page)
 {
+	return page->num_keys * (int)sizeof(slot_t) + LEAF_DATA_SIZE - (int)page->values_start;
+}
 
-	page_t * new_leaf;
-	page_t* page = (page_t*)malloc(sizeof(page_t));
-	file_read_page(leaf_page, page);
+// Bytes free between a leaf's slots and its values.
+static int leaf_free(page_t * page)
+{
+	return (int)page->values_start - page->num_keys * (int)sizeof(slot_t);
+}
 
-	record_t temp_records[order];
+// Bytes a record takes in a leaf, slot included.
+static int record_size(const record_t * record)
+{
+	return (int)sizeof(slot_t) + record->size;
+}
 
-	int insertion_index, split, i, j;
-	int64_t new_key;
+/* Makes a zeroed page an empty leaf.
+*/
+static void leaf_init(page_t * page)
+{
+	page->is_leaf = true;
+	page->num_keys = 0;
+	page->values_start = LEAF_DATA_SIZE;
+}
 
-	new_leaf = make_leaf();
-	pagenum_t new_leaf_num = file_alloc_page();
+/* Puts a record at slot index of a leaf that has
+* room for it.
+*/
+static void leaf_insert_at(page_t * page, int index, const record_t * record)
+{
+	slot_t * slot;
+	page->values_start -= record->size;
+	memcpy(page->data + page->values_start, record->data, record->size);
+	memmove(&page->slots[index + 1], &page->slots[index],
+			sizeof(slot_t) * (page->num_keys - index));
+	slot = &page->slots[index];
+	slot->key = record->key;
+	slot->offset = page->values_start;
+	slot->size = record->size;
+	slot->length = record->length;
+	page->num_keys++;
+}
 
-	insertion_index = 0;
-	while ( insertion_index < order - 1 && page->records[insertion_index].key < pointer->key )
-		insertion_index++;
+/* Describes the record at slot index of a leaf, so
+* it can be moved to another leaf as it is.
+*/
+static void leaf_record(page_t * page, int index, record_t * record)
+{
+	slot_t * slot = &page->slots[index];
+	record->key = slot->key;
+	record->length = slot->length;
+	record->size = slot->size;
+	record->data = page->data + slot->offset;
+	record->overflow = 0;
+	if ( slot->length > LEAF_INLINE_MAX )
+		memcpy(&record->overflow, record->data, sizeof(pagenum_t));
+}
 
-	for ( i = 0, j = 0; i < page->num_keys; i++, j++ )
+/* Removes the record at slot index from a leaf.
+* The values below its value move up to close the
+* gap, so the free space stays in one piece.
+*/
+static void leaf_remove_at(page_t * page, int index)
+{
+	slot_t removed = page->slots[index];
+	int i;
+	memmove(page->data + page->values_start + removed.size, page->data + page->values_start,
+			removed.offset - page->values_start);
+	page->values_start += removed.size;
+	memmove(&page->slots[index], &page->slots[index + 1],
+			sizeof(slot_t) * (page->num_keys - index - 1));
+	page->num_keys--;
+	for ( i = 0; i < page->num_keys; i++ )
 	{
-		if ( j == insertion_index ) j++;
-		temp_records[j].key = page->records[i].key;
-		strcpy(temp_records[j].value, page->records[i].value);
+		if ( page->slots[i].offset < removed.offset )
+			page->slots[i].offset += removed.size;
 	}
+}
 
-	temp_records[insertion_index].key = pointer->key;
-	strcpy(temp_records[insertion_index].value, pointer->value);
-
-	page->num_keys = 0;
-
-	split = cut(order - 1);
-
-	for ( i = 0; i <= split; i++ )
+/* Copies the value of the record at slot index of a
+* leaf being read to value, which must have room for
+* MAX_VALUE_SIZE + 1 bytes, following its overflow
+* pages if it has any.  Those never change while a
+* leaf refers to them, so they are read unlatched;
+* a leaf read optimistically is validated by the
+* caller afterwards.
+* Returns 0, or -1 if the slot makes no sense, which
+* only an optimistic read can run into.
+*/
+static int read_value(int table_id, page_t * page, int index, char * value)
+{
+	slot_t slot = page->slots[index];
+	overflow_page_t * overflow;
+	pagenum_t pagenum;
+	uint32_t done, n;
+
+	if ( slot.offset + slot.size > LEAF_DATA_SIZE )
+		return -1;
+	if ( slot.length <= LEAF_INLINE_MAX )
 	{
-		page->records[i].key = temp_records[i].key;
-		strcpy(page->records[i].value, temp_records[i].value);
-		page->num_keys++;
+		if ( slot.size != slot.length )
+			return -1;
+		memcpy(value, page->data + slot.offset, slot.length);
+		value[slot.length] = '\0';
+		return 0;
 	}
-
-	for ( i = split + 1, j = 0; i < order; i++, j++ )
+	if ( slot.size != sizeof(pagenum_t) || slot.length > MAX_VALUE_SIZE )
+		return -1;
+	memcpy(&pagenum, page->data + slot.offset, sizeof(pagenum_t));
+	for ( done = 0; done < slot.length; done += n )
 	{
-		new_leaf->records[j].key = temp_records[i].key;
-		strcpy(new_leaf->records[j].value, temp_records[i].value);
-		new_leaf->num_keys++;
+		if ( pagenum == 0 || pagenum >= tables[table_id].header->num )
+			return -1;
+		overflow = (overflow_page_t *)buf_get_page(table_id, pagenum);
+		n = slot.length - done < OVERFLOW_DATA_SIZE ? slot.length - done : OVERFLOW_DATA_SIZE;
+		memcpy(value + done, overflow->data, n);
+		pagenum = overflow->next;
+		buf_put_page((page_t *)overflow, false);
 	}
+	value[slot.length] = '\0';
+	return 0;
+}
 
-	new_leaf->right_sibling = page->right_sibling;
-	page->right_sibling = new_leaf_num;
+/* Writes a long value to a new chain of overflow
+* pages and returns the first of them.  The chain is
+* built back to front so every page is written once.
+*/
+static pagenum_t write_overflow(int table_id, const char * value, uint32_t length)
+{
+	overflow_page_t * overflow;
+	pagenum_t pagenum, next = 0;
+	int64_t start;
 
-	new_leaf->parent = page->parent;
-	new_key = new_leaf->records[0].key;
+	for ( start = (length - 1) / OVERFLOW_DATA_SIZE * OVERFLOW_DATA_SIZE; start >= 0;
+		  start -= OVERFLOW_DATA_SIZE )
+	{
+		overflow = (overflow_page_t *)buf_alloc_page(table_id, &pagenum);
+		memcpy(overflow->data, value + start,
+			   length - start < OVERFLOW_DATA_SIZE ? length - start : OVERFLOW_DATA_SIZE);
+		overflow->next = next;
+		buf_put_page((page_t *)overflow, true);
+		next = pagenum;
+	}
+	return next;
+}
 
-	file_write_page(new_leaf_num, new_leaf);
-	file_write_page(leaf_page, page);
+/* Frees the overflow pages of a record no leaf
+* refers to any more (pagenum 0: none).
+*/
+static void free_overflow(int table_id, pagenum_t pagenum)
+{
+	overflow_page_t * overflow;
+	pagenum_t next;
+	while ( pagenum != 0 )
+	{
+		overflow = (overflow_page_t *)buf_get_page(table_id, pagenum);
+		next = overflow->next;
+		buf_put_page((page_t *)overflow, false);
+		buf_free_page(table_id, pagenum);
+		pagenum = next;
+	}
+}
 
-	return insert_into_parent(page->parent, leaf_page, new_key, new_leaf_num);
+/* Installs a new root.  Optimistic descents check
+* root_version around picking up the root, so the
+* page must be complete before it is installed, and
+* an old root only freed after.
+*/
+static void set_root(int table_id, pagenum_t root)
+{
+	__atomic_store_n(&tables[table_id].header->root, root, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&tables[table_id].root_version, 1, __ATOMIC_RELEASE);
 }
 
+/* Drops the rightmost leaf hint if it names a leaf
+* about to be freed.  Called with the leaf still
+* latched, so a fast path insert waiting for that
+* latch finds the hint gone (see find_rightmost).
+*/
+static void forget_rightmost(int table_id, pagenum_t pagenum)
+{
+	__atomic_compare_exchange_n(&tables[table_id].rightmost, &pagenum, 0, false,
+								__ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
 
-/* Inserts a new key and pointer to a node
-* into a node into which these can fit
-* without violating the B+ tree properties.
+/* Abandons a page read that failed validation.
 */
-int insert_into_node(pagenum_t parent_num,
-					 int my_index, int64_t key, pagenum_t right_num)
+static int read_abort(page_t * page, bool latched)
 {
-	int i;
+	buf_read_end(page, latched);
+	buf_put_page(page, false);
+	return -1;
+}
 
-	page_t* parent = (page_t*)malloc(sizeof(page_t));
-	file_read_page(parent_num, parent);
 
-	for ( i = (parent->num_keys - 1); i >= my_index; i-- )
+/* Traces the path from the root to a leaf, searching
+* by key.  Displays information about the path
+* if the verbose flag is set.
+* If path is not NULL, every page on the way down
+* and the slot taken in it are recorded there,
+* ending with the leaf itself.
+* Each page is read between buf_read_begin and
+* buf_read_end, and the child is begun before its
+* parent is let go.  With latched set that crabs
+* shared latches down the tree.  Otherwise nothing
+* is latched: every pointer is checked against the
+* version of the page it came from before it is
+* followed, and again once the child is begun, and
+* -1 is returned as soon as a writer got in the way.
+* Returns 0 with the leaf pinned, still being read,
+* and its version in *version, or 1 if the tree
+* is empty.
+*/
+int find_leaf(int table_id, int64_t key, path_t * path, bool latched,
+			  page_t ** leaf, uint64_t * version)
+{
+	table_t * table = &tables[table_id];
+	int i = 0;
+	pagenum_t pagenum = 0, child_num;
+	page_t * page, * child;
+	uint64_t root_version, v, child_v;
+	int64_t high = INT64_MAX;
+
+	if ( path != NULL )
+		path->depth = 0;
+
+	if ( latched )
+		pthread_rwlock_rdlock(&table->root_latch);
+	root_version = __atomic_load_n(&table->root_version, __ATOMIC_ACQUIRE);
+	pagenum = __atomic_load_n(&table->header->root, __ATOMIC_ACQUIRE);
+	if ( pagenum == 0 )
 	{
-		parent->branches[i + 1].key = parent->branches[i].key;
-		parent->branches[i + 1].child = parent->branches[i].child;
+		if ( latched )
+			pthread_rwlock_unlock(&table->root_latch);
+		return 1;
 	}
-	parent->branches[my_index].child = right_num;
-	parent->branches[my_index].key = key;
-	parent->num_keys++;
+	page = buf_get_page(table_id, pagenum);
+	v = buf_read_begin(page, latched);
+	if ( latched )
+		pthread_rwlock_unlock(&table->root_latch);
+	else if ( __atomic_load_n(&table->root_version, __ATOMIC_ACQUIRE) != root_version )
+		return read_abort(page, latched);
 
-	file_write_page(parent_num, parent);
+	while ( !page->is_leaf )
+	{
+		i = internal_search(page, key);
+		child_num = node_child(page, i);
+		if ( i + 1 < safe_num_keys(page) )
+			high = node_key(page, i + 1);
+		if ( !buf_read_valid(page, v) )
+			return read_abort(page, latched);
+		if ( path != NULL )
+			path_push(path, pagenum, i);
+
+		child = buf_get_page(table_id, child_num);
+		child_v = buf_read_begin(child, latched);
+		if ( !buf_read_valid(page, v) )
+		{
+			read_abort(child, latched);
+			return read_abort(page, latched);
+		}
+		buf_read_end(page, latched);
+		buf_put_page(page, false);
+		page = child;
+		pagenum = child_num;
+		v = child_v;
+	}
+	if ( path != NULL )
+	{
+		path_push(path, pagenum, 0);
+		path->high = high;
+	}
+	*leaf = page;
+	*version = v;
 	return 0;
 }
 
-
-/* Inserts a new key and pointer to a node
-* into a node, causing the node's size to exceed
-* the order, and causing the node to split into two.
+/* Returns true if page can take one more entry
+* (inserting) or lose one (deleting) without
+* splitting or underflowing, so a change made
+* below it cannot reach its ancestors.
+* In a leaf the entry is a record of size bytes
+* (see record_size); a deletion does not know the
+* size yet and assumes the largest.  In an internal
+* page an insertion is of a key between low and
+* high, the range of the child the descent takes
+* (see node_has_room).
 */
-int insert_into_node_after_splitting(pagenum_t old_parent_num, int my_index,
-									 int64_t key, pagenum_t right_num)
+bool is_safe(int table_id, page_t * page, bool is_root, bool inserting, int size,
+			 int64_t low, int64_t high)
 {
+	if ( inserting )
+		return page->is_leaf ? leaf_free(page) >= size : node_has_room(table_id, page, low, high);
+	if ( is_root )
+		return page->num_keys > 1;
+	if ( page->is_leaf )
+		return leaf_used(page) - LEAF_MAX_RECORD >= LEAF_MIN_USED;
+	return page->num_keys > cut(INTERNAL_ORDER) - 1;
+}
 
-	int i, j, split;
-	int64_t k_prime;
-
-	page_t* new_node = make_node();
-	pagenum_t new_node_num = file_alloc_page();
-
-	page_t* old_parent = (page_t*)malloc(sizeof(page_t));
-	file_read_page(old_parent_num, old_parent);
-
-	/* First create a temporary set of keys and pointers
-	* to hold everything in order, including
-	* the new key and pointer, inserted in their
-	* correct places.
-	* Then create a new node and copy half of the
-	* keys and pointers to the old node and
-	* the other half to the new.
+/* Descends to the leaf that key belongs in for an
+* insertion of a record of size bytes or a
+* deletion, crabbing exclusive latches:
+* every page stays latched in path->latched until a
+* page below it is found safe (is_safe), at which
+* point all of its ancestors, and the root latch, are
+* released.  What is left latched is exactly what
+* the change can reach.
+* The optimistic variant descends like a reader,
+* latching nothing, and then latches only the leaf
+* exclusively.  It returns NULL if the leaf changed
+* in between, turns out unsafe, or the tree is
+* empty, and the caller then retries pessimistically.
+* The pessimistic variant returns NULL only for an
+* empty tree, with the root latch still held.
+* The leaf is returned pinned and write-latched;
+* everything is released with path_release.
+*/
+page_t * find_leaf_for_update(int table_id, int64_t key, path_t * path,
+							  bool inserting, int size, bool optimistic)
+{
+	pagenum_t pagenum;
+	page_t * page, * child;
+	uint64_t version;
+	int i;
+	/* Keys the page reached covers, and those of the
+	* child taken from it; INT64_MIN and INT64_MAX
+	* stand for no bound.
 	*/
+	int64_t low = INT64_MIN, high = INT64_MAX, child_low, child_high;
 
-	branch_t temp_branches[250];
+	path->depth = 0;
+	path->latched_depth = 0;
+	path->root_latched = false;
+	path->append = false;
 
-	for ( i = 0, j = 0; i < old_parent->num_keys; i++, j++ )
+	if ( optimistic )
 	{
-		if ( j == my_index ) j++;
-		temp_branches[j].key = old_parent->branches[i].key;
-		temp_branches[j].child = old_parent->branches[i].child;
+		if ( find_leaf(table_id, key, path, false, &page, &version) != 0 )
+			return NULL;
+		buf_latch_page(page, true);
+		if ( page->version != version + 1
+			 || !is_safe(table_id, page, path->depth == 1, inserting, size, 0, 0) )
+		{
+			buf_unlatch_page(page);
+			buf_put_page(page, false);
+			return NULL;
+		}
+		for ( i = 0; i < path->depth - 1; i++ )
+			path->latched[i] = NULL;
+		path->latched[path->depth - 1] = page;
+		path->latched_depth = path->depth;
+		return page;
 	}
 
-	temp_branches[my_index].key = key;
-	temp_branches[my_index].child = right_num;
+	path->root_latched = true;
+	pthread_rwlock_wrlock(&tables[table_id].root_latch);
+	pagenum = tables[table_id].header->root;
+	if ( pagenum == 0 )
+		return NULL;
+	page = buf_get_page(table_id, pagenum);
+	buf_latch_page(page, true);
 
-	/* Create the new node and copy
-	* half the keys and pointers to the
-	* old and half to the new.
-	*/
-	split = cut(INTERNAL_ORDER);
+	while ( true )
+	{
+		i = page->is_leaf ? 0 : internal_search(page, key);
+		child_low = page->is_leaf || i == -1 ? low : node_key(page, i);
+		child_high = page->is_leaf || i == page->num_keys - 1 ? high : node_key(page, i + 1);
+		if ( is_safe(table_id, page, path->depth == 0, inserting, size, child_low, child_high) )
+			path_release(table_id, path);
+
+		path_push(path, pagenum, i);
+		path->latched[path->depth - 1] = page;
+		path->latched_depth = path->depth;
+		if ( page->is_leaf )
+		{
+			path->high = high;
+			break;
+		}
 
-	old_parent->num_keys = 0;
+		low = child_low;
+		high = child_high;
+		pagenum = node_child(page, i);
+		child = buf_get_page(table_id, pagenum);
+		buf_latch_page(child, true);
+		page = child;
+	}
+	return page;
+}
 
-	for ( i = 0; i < split; i++ )
+/* Fast path of an insertion of ascending keys: the
+* leaf named by the table's rightmost hint, pinned
+* and write-latched, with path holding just that
+* leaf, if key lies beyond every key in it and a
+* record of size bytes fits without a split.  NULL
+* otherwise, with nothing held.
+* Any key above the last one of the rightmost leaf
+* belongs there, so no descent is needed.  The hint
+* is checked again once the leaf is latched: a leaf
+* is only freed latched and after forget_rightmost,
+* so a hint that survives names a leaf of the tree,
+* and having no right sibling it is the rightmost.
+*/
+page_t * find_rightmost(int table_id, int64_t key, path_t * path, int size)
+{
+	pagenum_t pagenum = __atomic_load_n(&tables[table_id].rightmost, __ATOMIC_ACQUIRE);
+	page_t * page;
+
+	if ( pagenum == 0 )
+		return NULL;
+	page = buf_get_page(table_id, pagenum);
+	buf_latch_page(page, true);
+	if ( __atomic_load_n(&tables[table_id].rightmost, __ATOMIC_ACQUIRE) != pagenum
+		 || !page->is_leaf || page->right_sibling != 0 || page->num_keys == 0
+		 || page->slots[page->num_keys - 1].key >= key || leaf_free(page) < size )
 	{
-		old_parent->branches[i].key = temp_branches[i].key;
-		old_parent->branches[i].child = temp_branches[i].child;
-		old_parent->num_keys++;
+		buf_unlatch_page(page);
+		buf_put_page(page, false);
+		return NULL;
 	}
-	//old_parent->right_sibling = new_node_num;
+	path->depth = 0;
+	path->root_latched = false;
+	path->append = false;
+	path->high = INT64_MAX;
+	path_push(path, pagenum, 0);
+	path->latched[0] = page;
+	path->latched_depth = 1;
+	return page;
+}
 
-	k_prime = temp_branches[split].key;
-	new_node->leftmost_child = temp_branches[split].child;
-	for ( ++i, j = 0; i <= old_parent->num_keys; i++, j++ )
+/* Releases the latches and pins a writer descent
+* still holds on path, and the root latch.
+*/
+void path_release(int table_id, path_t * path)
+{
+	int i;
+	for ( i = 0; i < path->latched_depth; i++ )
 	{
-		new_node->branches[j].key = temp_branches[i].key;
-		new_node->branches[j].child = temp_branches[i].child;
-		new_node->num_keys++;
+		if ( path->latched[i] != NULL )
+		{
+			buf_unlatch_page(path->latched[i]);
+			buf_put_page(path->latched[i], false);
+			path->latched[i] = NULL;
+		}
 	}
-
-	pagenum_t grand_parent = old_parent->parent;
-	new_node->parent = grand_parent;
-
-	page_t* child = (page_t*)malloc(sizeof(page_t));
-
-	file_read_page(new_node->leftmost_child, child);
-
-	child->parent = new_node_num;
-	file_write_page(new_node->leftmost_child, child);
-
-	for ( i = 0; i < new_node->num_keys; i++ )
+	if ( path->root_latched )
 	{
-		file_read_page(new_node->branches[i].child, child);
-		child->parent = new_node_num;
-		file_write_page(new_node->branches[i].child, child);
+		pthread_rwlock_unlock(&tables[table_id].root_latch);
+		path->root_latched = false;
 	}
+}
 
-	/* Insert a new key into the parent of the two
-	* nodes resulting from the split, with
-	* the old node to the left and the new to the right.
-	*/
-
-
-	file_write_page(old_parent_num, old_parent);
-	file_write_page(new_node_num, new_node);
-
-	return insert_into_parent(grand_parent, old_parent_num, k_prime, new_node_num);
+/* Appends a page and the slot taken in it
+* (-1 for leftmost_child) to a descent path.
+*/
+void path_push(path_t * path, pagenum_t pagenum, int index)
+{
+	if ( path->depth == MAX_HEIGHT )
+	{
+		fprintf(stderr, "Tree deeper than %d levels.\n", MAX_HEIGHT);
+		exit(EXIT_FAILURE);
+	}
+	path->pagenum[path->depth] = pagenum;
+	path->index[path->depth] = index;
+	path->depth++;
 }
 
+/* Looks up the transaction an operation runs in
+* and locks the record it is about to touch, before
+* any latch is taken, so that waiting for the lock
+* never holds up a page.
+* trx_id 0 runs the operation in a transaction of
+* its own, kept in *implicit.
+* Returns NULL if trx_id is not active, or if the
+* lock could only be waited for by deadlocking, in
+* which case the transaction has been aborted.
+*/
+static trx_t * record_lock(int table_id, int64_t key, int trx_id, int mode,
+						   trx_t * implicit)
+{
+	trx_t * trx = trx_enter(trx_id, implicit);
+	if ( trx == NULL )
+		return NULL;
+	if ( lock_acquire(trx, table_id, key, mode) == LOCK_DEADLOCK )
+	{
+		if ( trx_id == 0 )
+			trx_leave(trx);
+		else
+			trx_abort(trx_id);
+		return NULL;
+	}
+	return trx;
+}
 
+/* Logs how to undo a change transaction trx is about
+* to make to key, before it is made, so the log never
+* holds a change without its undo.  The record must
+* be locked exclusively.  An implicit transaction
+* keeps no undo.
+* Returns false if the change would fail anyway: an
+* insertion needs the key absent, a deletion or an
+* update needs it present.
+*/
+static bool log_undo(trx_t * trx, int type, int table_id, int64_t key)
+{
+	char old_value[MAX_VALUE_SIZE + 1];
+	bool exists;
+	if ( trx->id == 0 )
+		return true;
+	exists = find_record(table_id, key, old_value) == 0;
+	if ( exists == (type == UNDO_INSERT) )
+		return false;
+	trx_add_undo(trx, type, table_id, key, exists ? old_value : NULL);
+	return true;
+}
 
-/* Inserts a new node (leaf or internal node) into the B+ tree.
-* Returns the root of the tree after insertion.
+/* Finds the record to which a key refers and
+* copies its value, under a shared lock on the
+* record held by transaction trx_id (0 for none).
+* Returns 0 if found, 1 if not or if the
+* transaction was aborted (see record_lock).
 */
-int insert_into_parent(pagenum_t parent_num, pagenum_t left_num, int64_t key, pagenum_t right_num)
+int db_find(int table_id, int64_t key, char * ret_val, int trx_id)
 {
+	trx_t implicit, * trx;
+	int result;
 
-	int my_index;
+	trx = record_lock(table_id, key, trx_id, LOCK_SHARED, &implicit);
+	if ( trx == NULL )
+		return 1;
+	if ( __atomic_load_n(&tables[table_id].header->root, __ATOMIC_ACQUIRE) == 0 )
+		printf("Empty tree.\n");
+	result = find_record(table_id, key, ret_val);
+	trx_leave(trx);
+	return result;
+}
 
-	page_t* parent = (page_t*)malloc(sizeof(page_t));
+/* Finds and returns the record to which
+* a key refers.  ret_val must have room for
+* MAX_VALUE_SIZE + 1 bytes.
+* The leaf is read optimistically; after
+* OPTIMISTIC_RETRIES failed attempts the lookup
+* falls back to shared latches.
+*/
+int find_record(int table_id, int64_t key, char * ret_val)
+{
+	int i = 0, attempt, rc;
+	bool found, valid;
+	bool latched;
+	uint64_t version;
+	page_t* page;
 
-	/* Case: new root. */
+	for ( attempt = 0; ; attempt++ )
+	{
+		latched = attempt >= OPTIMISTIC_RETRIES;
+		rc = find_leaf(table_id, key, NULL, latched, &page, &version);
+		if ( rc == 1 )
+			return 1;
+		if ( rc == -1 )
+			continue;
+
+		i = leaf_search(page, key);
+		found = i < safe_num_keys(page) && page->slots[i].key == key;
+		valid = !found || read_value(table_id, page, i, ret_val) == 0;
+		valid = buf_read_valid(page, version) && valid;
+		buf_read_end(page, latched);
+		buf_put_page(page, false);
+		if ( valid )
+			break;
+	}
+	return found ? 0 : 1;
+}
 
-	if ( parent_num == 0 )
-		return insert_into_new_root(left_num, key, right_num);
+// Unpins the pages of a find_sorted walk.
+static void release_walk(page_t ** pages, int * depth)
+{
+	while ( *depth > 0 )
+		read_abort(pages[--*depth], false);
+}
 
-	/* Case: leaf or node. (Remainder of
-	* function body.)
+/* Looks up the n keys of entries, sorted by key
+* (see db_find_many), with one optimistic walk
+* over the tree.  The walk keeps the pages from the
+* root to the current leaf pinned, each with the
+* version it was read at and the bound its keys are
+* below.  A key is looked for in the current leaf if
+* it is below the leaf's bound; otherwise the walk
+* climbs only to the lowest page still covering it
+* and descends from there, so the keys of one leaf
+* read it once and keys in neighboring leaves share
+* all but the end of their path.  A page is used
+* again only while its version is unchanged, which
+* also means its range is.  Any other change starts
+* the walk again from the root, and a key that keeps
+* failing after OPTIMISTIC_RETRIES attempts is left
+* to find_record, which latches.
+* Returns the number of keys found.
+*/
+static int find_sorted(int table_id, int64_t (* entries)[2], int n, char ** values,
+					   int * results)
+{
+	table_t * table = &tables[table_id];
+	page_t * pages[MAX_HEIGHT], * page, * child;
+	uint64_t versions[MAX_HEIGHT], root_version;
+	int64_t highs[MAX_HEIGHT], key, high;
+	pagenum_t pagenum;
+	int depth = 0, attempt = 0, found = 0, i = 0, j, k;
+	bool valid;
+
+	while ( i < n )
+	{
+		key = entries[i][0];
+		j = entries[i][1];
+		if ( i > 0 && key == entries[i - 1][0] )
+		{
+			results[j] = results[entries[i - 1][1]];
+			if ( results[j] == 0 )
+			{
+				strcpy(values[j], values[entries[i - 1][1]]);
+				found++;
+			}
+			i++;
+			continue;
+		}
+		if ( attempt >= OPTIMISTIC_RETRIES )
+		{
+			release_walk(pages, &depth);
+			results[j] = find_record(table_id, key, values[j]);
+			found += results[j] == 0;
+			attempt = 0;
+			i++;
+			continue;
+		}
+
+		while ( depth > 0 && key >= highs[depth - 1] )
+			read_abort(pages[--depth], false);
+		if ( depth == 0 )
+		{
+			root_version = __atomic_load_n(&table->root_version, __ATOMIC_ACQUIRE);
+			pagenum = __atomic_load_n(&table->header->root, __ATOMIC_ACQUIRE);
+			if ( pagenum == 0 )
+			{
+				results[j] = 1;
+				i++;
+				continue;
+			}
+			pages[0] = buf_get_page(table_id, pagenum);
+			versions[0] = buf_read_begin(pages[0], false);
+			highs[0] = INT64_MAX;
+			depth = 1;
+			if ( __atomic_load_n(&table->root_version, __ATOMIC_ACQUIRE) != root_version )
+			{
+				release_walk(pages, &depth);
+				attempt++;
+				continue;
+			}
+		}
+
+		valid = true;
+		while ( valid && !pages[depth - 1]->is_leaf )
+		{
+			page = pages[depth - 1];
+			k = internal_search(page, key);
+			pagenum = node_child(page, k);
+			high = k + 1 < safe_num_keys(page) ? node_key(page, k + 1) : highs[depth - 1];
+			valid = buf_read_valid(page, versions[depth - 1]) && depth < MAX_HEIGHT;
+			if ( !valid )
+				break;
+			child = buf_get_page(table_id, pagenum);
+			pages[depth] = child;
+			versions[depth] = buf_read_begin(child, false);
+			highs[depth++] = high;
+			valid = buf_read_valid(page, versions[depth - 2]);
+		}
+		if ( valid )
+		{
+			page = pages[depth - 1];
+			k = leaf_search(page, key);
+			results[j] = k < safe_num_keys(page) && page->slots[k].key == key ? 0 : 1;
+			valid = results[j] == 1 || read_value(table_id, page, k, values[j]) == 0;
+			valid = buf_read_valid(page, versions[depth - 1]) && valid;
+		}
+		if ( !valid )
+		{
+			release_walk(pages, &depth);
+			attempt++;
+			continue;
+		}
+		found += results[j] == 0;
+		attempt = 0;
+		i++;
+	}
+	release_walk(pages, &depth);
+	return found;
+}
+
+/* Looks up n keys as part of transaction trx_id
+* (0 for none), as n calls to db_find would, and
+* stores the value of keys[i] in values[i], which
+* must have room for MAX_VALUE_SIZE + 1 bytes, and
+* 0 (found) or 1 (not found) in results[i].
+* Every key is locked first, in key order.  The keys
+* are then looked up in that order by find_sorted,
+* in one walk over the tree.
+* Returns the number of keys found, or -1 if
+* trx_id is not active or the transaction was
+* aborted on a lock.
+*/
+int db_find_many(int table_id, int64_t * keys, char ** values, int * results, int n,
+				 int trx_id)
+{
+	trx_t implicit, * trx;
+	int64_t (* entries)[2];
+	int i, found;
+
+	entries = malloc(sizeof(*entries) * (n > 0 ? n : 1));
+	if ( entries == NULL )
+	{
+		perror("Batch find.");
+		exit(EXIT_FAILURE);
+	}
+	for ( i = 0; i < n; i++ )
+	{
+		entries[i][0] = keys[i];
+		entries[i][1] = i;
+	}
+	qsort(entries, n, sizeof(*entries), compare_entries);
+
+	trx = trx_enter(trx_id, &implicit);
+	if ( trx == NULL )
+	{
+		free(entries);
+		return -1;
+	}
+	for ( i = 0; i < n; i++ )
+	{
+		if ( i > 0 && entries[i][0] == entries[i - 1][0] )
+			continue;
+		if ( lock_acquire(trx, table_id, entries[i][0], LOCK_SHARED) == LOCK_DEADLOCK )
+		{
+			if ( trx_id == 0 )
+				trx_leave(trx);
+			else
+				trx_abort(trx_id);
+			free(entries);
+			return -1;
+		}
+	}
+	found = find_sorted(table_id, entries, n, values, results);
+	trx_leave(trx);
+	free(entries);
+	return found;
+}
+
+// RANGE SCAN
+
+/* Hints to the buffer pool the SCAN_PREFETCH leaves
+* that follow (or, backward, precede) the leaf
+* holding key, as listed in that leaf's parent, so
+* their reads overlap with the scan instead of
+* being issued one right_sibling at a time.
+* Only a hint, so a single optimistic attempt is
+* made and nothing is hinted if it fails.
+* Must be called holding no latch.
+* Returns the number of leaves hinted.
+*/
+int prefetch_leaves(int table_id, int64_t key, bool backward)
+{
+	pagenum_t pages[SCAN_PREFETCH];
+	path_t path;
+	page_t* parent;
+	uint64_t version;
+	int i, num_keys, n = 0;
+
+	if ( find_leaf(table_id, key, &path, false, &parent, &version) != 0 )
+		return 0;
+	buf_read_end(parent, false);
+	buf_put_page(parent, false);
+	if ( path.depth < 2 )
+		return 0;
+
+	parent = buf_get_page(table_id, path.pagenum[path.depth - 2]);
+	version = buf_read_begin(parent, false);
+	i = path.index[path.depth - 2];
+	num_keys = safe_num_keys(parent);
+	if ( parent->is_leaf || i >= num_keys )
+		n = 0;
+	else if ( !backward )
+	{
+		for ( i++; i < num_keys && n < SCAN_PREFETCH; i++ )
+			pages[n++] = node_child(parent, i);
+	}
+	else
+	{
+		for ( i--; i >= -1 && n < SCAN_PREFETCH; i-- )
+			pages[n++] = node_child(parent, i);
+	}
+	if ( !buf_read_valid(parent, version) )
+		n = 0;
+	buf_read_end(parent, false);
+	buf_put_page(parent, false);
+
+	buf_prefetch(table_id, pages, n);
+	return n;
+}
+
+/* Opens a cursor over the keys in [begin, end],
+* returned in ascending order, or descending if
+* backward is set.  The cursor holds no pinned
+* page between calls; the first db_scan_next finds
+* the starting leaf, so the position cannot go stale
+* before it is used.
+*/
+int db_scan(int table_id, cursor_t * cursor, int64_t begin, int64_t end, bool backward)
+{
+	cursor->table_id = table_id;
+	cursor->begin = begin;
+	cursor->end = end;
+	cursor->backward = backward;
+	cursor->positioned = begin > end;
+	cursor->last_key = backward ? end : begin;
+	cursor->prefetched = 0;
+	cursor->leaf = 0;
+	return 0;
+}
+
+/* Finds the first record of a new cursor.
+* Returns as find_leaf does, with the leaf in *page.
+*/
+static int cursor_position(cursor_t * cursor, bool latched, page_t ** page, uint64_t * version)
+{
+	path_t path;
+	int64_t start = cursor->backward ? cursor->end : cursor->begin;
+	int rc;
+
+	cursor->positioned = true;
+	rc = find_leaf(cursor->table_id, start, &path, latched, page, version);
+	if ( rc == 1 )
+		printf("Empty tree.\n");
+	if ( rc != 0 )
+		return rc;
+	cursor->leaf = path.pagenum[path.depth - 1];
+	cursor->index = leaf_search(*page, start);
+	if ( cursor->backward && (cursor->index == safe_num_keys(*page) ||
+							  (*page)->slots[cursor->index].key > cursor->end) )
+		cursor->index--;
+	return 0;
+}
+
+/* Moves a backward cursor to the last record of
+* the leaf before the one holding bound.  Leaves
+* only link to the right, so the previous leaf is
+* found from the descent path: the rightmost leaf
+* under the nearest ancestor slot that has a left
+* neighbor.
+* The path is only a snapshot once the descent lets
+* go of it, so the leaf found is accepted only if it
+* still links to the leaf holding bound; otherwise
+* -1 is returned and the step retried.
+* Returns as find_leaf does, with the new leaf in
+* *page, or 1 at the start of the tree.
+*/
+static int cursor_step_back(cursor_t * cursor, int64_t bound, bool latched,
+							page_t ** page, uint64_t * version)
+{
+	page_t* child;
+	path_t path;
+	pagenum_t prev, leaf;
+	uint64_t v, child_v;
+	int level, i, rc;
+
+	rc = find_leaf(cursor->table_id, bound, &path, latched, page, &v);
+	if ( rc != 0 )
+		return rc;
+	leaf = path.pagenum[path.depth - 1];
+	buf_read_end(*page, latched);
+	buf_put_page(*page, false);
+
+	for ( level = path.depth - 2; level >= 0 && path.index[level] == -1; level-- )
+		;
+	if ( level < 0 )
+		return 1;
+
+	*page = buf_get_page(cursor->table_id, path.pagenum[level]);
+	v = buf_read_begin(*page, latched);
+	i = path.index[level];
+	if ( (*page)->is_leaf || i >= safe_num_keys(*page) )
+		return read_abort(*page, latched);
+	prev = node_child(*page, i - 1);
+
+	while ( !(*page)->is_leaf )
+	{
+		if ( !buf_read_valid(*page, v) )
+			return read_abort(*page, latched);
+		child = buf_get_page(cursor->table_id, prev);
+		child_v = buf_read_begin(child, latched);
+		if ( !buf_read_valid(*page, v) )
+		{
+			read_abort(child, latched);
+			return read_abort(*page, latched);
+		}
+		buf_read_end(*page, latched);
+		buf_put_page(*page, false);
+		*page = child;
+		v = child_v;
+		if ( !(*page)->is_leaf )
+		{
+			i = safe_num_keys(*page);
+			prev = node_child(*page, i - 1);
+		}
+	}
+	if ( (*page)->right_sibling != leaf || !buf_read_valid(*page, v) )
+		return read_abort(*page, latched);
+	cursor->leaf = prev;
+	cursor->index = safe_num_keys(*page) - 1;
+	*version = v;
+	return 0;
+}
+
+/* Re-finds the cursor position from the last key
+* returned if the tree changed underneath it
+* (the slot no longer holds that key).
+* *page is the cursor leaf, being read; it is
+* replaced by the leaf now holding the position.
+* Returns as find_leaf does.
+*/
+static int cursor_revalidate(cursor_t * cursor, bool latched, page_t ** page, uint64_t * version)
+{
+	path_t path;
+	int i = cursor->backward ? cursor->index + 1 : cursor->index - 1;
+	int rc;
+
+	if ( (*page)->is_leaf && i >= 0 && i < safe_num_keys(*page) &&
+		(*page)->slots[i].key == cursor->last_key )
+		return 0;
+
+	buf_read_end(*page, latched);
+	buf_put_page(*page, false);
+	rc = find_leaf(cursor->table_id, cursor->last_key, &path, latched, page, version);
+	if ( rc != 0 )
+		return rc;
+	cursor->leaf = path.pagenum[path.depth - 1];
+	i = leaf_search(*page, cursor->last_key);
+	if ( cursor->backward )
+		cursor->index = i - 1;
+	else
+		cursor->index = i < safe_num_keys(*page) && (*page)->slots[i].key == cursor->last_key ? i + 1 : i;
+	return 0;
+}
+
+/* Makes one attempt at finding the next record of
+* a cursor and copies it to *key and value.
+* Moving right, the next leaf is begun before the
+* current one is let go, so a leaf being merged away
+* is never followed.  Descents (step back) only
+* start with no leaf held.
+* Read optimistically, a page is validated before
+* any pointer out of it is followed and before what
+* was copied from it is returned.
+* Returns 0 on success, 1 once the range is
+* exhausted, or -1 if the attempt must be retried,
+* in which case the cursor is left inconsistent and
+* the caller discards it.
+*/
+static int scan_step(cursor_t * cursor, int64_t * key, char * value, bool latched, bool * entered)
+{
+	page_t* page, * next;
+	pagenum_t next_num;
+	uint64_t version, next_version;
+	int64_t bound;
+	int rc;
+
+	if ( !cursor->positioned )
+	{
+		rc = cursor_position(cursor, latched, &page, &version);
+		*entered = true;
+	}
+	else if ( cursor->leaf == 0 )
+		return 1;
+	else
+	{
+		page = buf_get_page(cursor->table_id, cursor->leaf);
+		version = buf_read_begin(page, latched);
+		rc = cursor_revalidate(cursor, latched, &page, &version);
+	}
+
+	while ( rc == 0 )
+	{
+		if ( !cursor->backward && cursor->index >= safe_num_keys(page) )
+		{
+			next_num = page->right_sibling;
+			if ( !buf_read_valid(page, version) )
+				return read_abort(page, latched);
+			next = NULL;
+			if ( next_num != 0 )
+			{
+				next = buf_get_page(cursor->table_id, next_num);
+				next_version = buf_read_begin(next, latched);
+				if ( !buf_read_valid(page, version) )
+				{
+					read_abort(next, latched);
+					return read_abort(page, latched);
+				}
+			}
+			buf_read_end(page, latched);
+			buf_put_page(page, false);
+			cursor->leaf = next_num;
+			cursor->index = 0;
+			*entered = true;
+			if ( next == NULL )
+				return 1;
+			page = next;
+			version = next_version;
+			continue;
+		}
+		if ( cursor->backward && cursor->index < 0 )
+		{
+			bound = safe_num_keys(page) > 0 ? page->slots[0].key : cursor->last_key;
+			if ( !buf_read_valid(page, version) )
+				return read_abort(page, latched);
+			buf_read_end(page, latched);
+			buf_put_page(page, false);
+			rc = cursor_step_back(cursor, bound, latched, &page, &version);
+			*entered = true;
+			continue;
+		}
+
+		*key = page->slots[cursor->index].key;
+		if ( read_value(cursor->table_id, page, cursor->index, value) != 0 ||
+			!buf_read_valid(page, version) )
+			return read_abort(page, latched);
+		buf_read_end(page, latched);
+		buf_put_page(page, false);
+		if ( cursor->backward ? *key < cursor->begin : *key > cursor->end )
+			return 1;
+		cursor->last_key = *key;
+		cursor->index += cursor->backward ? -1 : 1;
+		return 0;
+	}
+	return rc;
+}
+
+/* Returns the next record of an open cursor in
+* key and value, which must have room for
+* MAX_VALUE_SIZE + 1 bytes.
+* Each step is first tried optimistically, on a copy
+* of the cursor, and after OPTIMISTIC_RETRIES failed
+* attempts with shared latches.
+* Returns 0 on success, 1 once the range is exhausted.
+*/
+int db_scan_next(cursor_t * cursor, int64_t * key, char * value)
+{
+	cursor_t step;
+	bool entered;
+	int attempt, rc;
+
+	for ( attempt = 0; ; attempt++ )
+	{
+		step = *cursor;
+		entered = false;
+		rc = scan_step(&step, key, value, attempt >= OPTIMISTIC_RETRIES, &entered);
+		if ( rc != -1 )
+			break;
+	}
+	*cursor = step;
+	if ( rc == 1 )
+	{
+		cursor->leaf = 0;
+		return 1;
+	}
+
+	/* On entering a leaf, keep at least half a
+	* window of leaves ahead already requested.
+	*/
+	if ( entered && --cursor->prefetched <= SCAN_PREFETCH / 2 )
+		cursor->prefetched = prefetch_leaves(cursor->table_id, *key, cursor->backward);
+	return 0;
+}
+
+void db_scan_close(cursor_t * cursor)
+{
+	cursor->leaf = 0;
+}
+
+
+/* Finds the appropriate place to
+* split a node that is too big into two.
+*/
+int cut(int length)
+{
+	if ( length % 2 == 0 )
+		return length / 2;
+	else
+		return length / 2 + 1;
+}
+
+
+// INSERTION
+
+/* Fills in a record to hold the value
+* to which a key refers.  A value too long for a
+* leaf is written to overflow pages here, before
+* any page is latched; the caller frees them
+* (free_overflow) if the record goes unused.
+* Returns 0, or 1 if the value is longer than
+* MAX_VALUE_SIZE.
+*/
+int make_record(int table_id, record_t * new_record, int64_t key, char* value)
+{
+	size_t length = strlen(value);
+	if ( length > MAX_VALUE_SIZE )
+		return 1;
+	new_record->key = key;
+	new_record->length = length;
+	new_record->overflow = 0;
+	if ( length <= LEAF_INLINE_MAX )
+	{
+		new_record->size = length;
+		new_record->data = value;
+	}
+	else
+	{
+		new_record->overflow = write_overflow(table_id, value, length);
+		new_record->size = sizeof(pagenum_t);
+		new_record->data = (const char *)&new_record->overflow;
+	}
+	return 0;
+}
+
+
+/* Creates a new general node, which can be adapted
+* to serve as either a leaf or an internal node.
+* The node is a zeroed, pinned buffer frame for a
+* freshly allocated page; the caller releases it
+* with buf_put_page.
+*/
+page_t * make_node(int table_id, pagenum_t * pagenum)
+{
+	return buf_alloc_page(table_id, pagenum);
+}
+
+/* Creates a new leaf by creating a node
+* and then adapting it appropriately.
+*/
+page_t * make_leaf(int table_id, pagenum_t * pagenum)
+{
+	page_t * leaf = make_node(table_id, pagenum);
+	leaf_init(leaf);
+	return leaf;
+}
+
+
+/* Inserts a new pointer to a record and its corresponding
+* key into a pinned leaf with room for it.  The caller
+* releases the leaf.
+*/
+int insert_into_leaf(page_t * page, record_t * pointer)
+{
+	leaf_insert_at(page, leaf_search(page, pointer->key), pointer);
+	return 0;
+}
+
+
+/* Inserts a new key and pointer
+* to a new record into a leaf so as to exceed
+* its space, causing the leaf to be split
+* in two halves of about the same number of bytes.
+* The leaf is the last page on path and arrives
+* pinned; it is released here.
+*/
+int insert_into_leaf_after_splitting(int table_id, path_t * path, page_t * page, record_t * pointer)
+{
+
+	page_t * new_leaf;
+	pagenum_t new_leaf_num;
+	pagenum_t leaf_page = path->pagenum[path->depth - 1];
+
+	page_t old_leaf;
+	record_t record;
+
+	int insertion_index, half, i, j;
+	int64_t new_key;
+
+	new_leaf = make_leaf(table_id, &new_leaf_num);
+
+	/* The records are dealt out again from a copy of
+	* the leaf, with the new one in its place: the
+	* left leaf takes them while it stays within half
+	* of the bytes, the new leaf the rest.
+	* Appending to the rightmost leaf, as ascending
+	* keys do, leaves APPEND_SPLIT_FILL percent on the
+	* left instead, since nothing will be inserted
+	* there again.
+	*/
+	memcpy(&old_leaf, page, sizeof(page_t));
+	insertion_index = leaf_search(page, pointer->key);
+	path->append = insertion_index == page->num_keys && page->right_sibling == 0;
+	half = (leaf_used(page) + record_size(pointer)) * (path->append ? APPEND_SPLIT_FILL : 50) / 100;
+	leaf_init(page);
+
+	for ( i = 0, j = 0; i <= old_leaf.num_keys; i++ )
+	{
+		if ( i == insertion_index )
+			record = *pointer;
+		else
+			leaf_record(&old_leaf, j++, &record);
+		if ( new_leaf->num_keys == 0 && leaf_used(page) + record_size(&record) <= half )
+			leaf_insert_at(page, page->num_keys, &record);
+		else
+			leaf_insert_at(new_leaf, new_leaf->num_keys, &record);
+	}
+
+	new_leaf->right_sibling = old_leaf.right_sibling;
+	page->right_sibling = new_leaf_num;
+
+	new_key = new_leaf->slots[0].key;
+
+	buf_put_page(new_leaf, true);
+	buf_put_page(page, true);
+
+	return insert_into_parent(table_id, path, leaf_page, new_key, new_leaf_num);
+}
+
+
+/* Inserts a new key and pointer to a node
+* into a node into which these can fit
+* without violating the B+ tree properties.
+* The parent arrives pinned; it is released here.
+*/
+int insert_into_node(page_t * parent,
+					 int my_index, int64_t key, pagenum_t right_num)
+{
+	int i;
+	int64_t keys[COMPACT_ORDER];
+	pagenum_t children[COMPACT_ORDER];
+	int n = node_unpack(parent, keys, children);
+
+	for ( i = (n - 1); i >= my_index; i-- )
+	{
+		keys[i + 1] = keys[i];
+		children[i + 1] = children[i];
+	}
+	children[my_index] = right_num;
+	keys[my_index] = key;
+	node_pack(parent, keys, children, n + 1);
+
+	buf_put_page(parent, true);
+	return 0;
+}
+
+
+/* Inserts a new key and pointer to a node
+* into a node, causing the node's size to exceed
+* the order, and causing the node to split into two.
+* The node is the last page on path and arrives
+* pinned; it is released here.
+*/
+int insert_into_node_after_splitting(int table_id, path_t * path, page_t * old_parent, int my_index,
+									 int64_t key, pagenum_t right_num)
+{
+
+	int i, j, n, split;
+	int64_t k_prime;
+
+	pagenum_t old_parent_num = path->pagenum[path->depth - 1];
+	pagenum_t new_node_num;
+	page_t* new_node = make_node(table_id, &new_node_num);
+
+	/* First create a temporary set of keys and pointers
+	* to hold everything in order, including
+	* the new key and pointer, inserted in their
+	* correct places.
+	* Then create a new node and copy half of the
+	* keys and pointers to the old node and
+	* the other half to the new.
+	* The halves are packed again in whichever layout
+	* suits them.  A full compact page splits into
+	* halves larger than a wide page, and the new key
+	* may stretch one of them past 2^32; the cut then
+	* moves so that half holds a wide page's worth.
+	* A split at the right edge leaves
+	* APPEND_SPLIT_FILL percent on the left.
+	*/
+
+	int64_t temp_keys[COMPACT_ORDER];
+	pagenum_t temp_children[COMPACT_ORDER];
+
+	n = old_parent->num_keys + 1;
+	for ( i = 0, j = 0; i < old_parent->num_keys; i++, j++ )
+	{
+		if ( j == my_index ) j++;
+		temp_keys[j] = node_key(old_parent, i);
+		temp_children[j] = node_child(old_parent, i);
+	}
+
+	temp_keys[my_index] = key;
+	temp_children[my_index] = right_num;
+
+	/* Create the new node and copy
+	* half the keys and pointers to the
+	* old and half to the new.
+	*/
+	split = cut(n);
+	if ( path->append && my_index == n - 1 )
+	{
+		split = n * APPEND_SPLIT_FILL / 100;
+		if ( split > n - 2 )
+			split = n - 2;
+	}
+	if ( split > INTERNAL_ORDER - 1 && !compact_fits(temp_keys, temp_children, split) )
+		split = INTERNAL_ORDER - 1;
+	if ( n - split - 1 > INTERNAL_ORDER - 1
+		 && !compact_fits(temp_keys + split + 1, temp_children + split + 1, n - split - 1) )
+		split = n - INTERNAL_ORDER;
+
+	node_pack(old_parent, temp_keys, temp_children, split);
+	//old_parent->right_sibling = new_node_num;
+
+	k_prime = temp_keys[split];
+	new_node->leftmost_child = temp_children[split];
+	node_pack(new_node, temp_keys + split + 1, temp_children + split + 1, n - split - 1);
+
+	/* Pages do not point up to their parents, so
+	* the children that moved are left untouched: the
+	* split writes the two halves and the parent only.
 	*/
 
-	/* Find the parent's pointer to the left
-	* node.
+	/* Insert a new key into the parent of the two
+	* nodes resulting from the split, with
+	* the old node to the left and the new to the right.
 	*/
 
-	file_read_page(parent_num, parent);
-	my_index = get_left_index(parent_num, left_num);
 
+	buf_put_page(old_parent, true);
+	buf_put_page(new_node, true);
+
+	return insert_into_parent(table_id, path, old_parent_num, k_prime, new_node_num);
+}
+
+
+
+/* Inserts a new node (leaf or internal node) into the B+ tree.
+* left_num is the last page on path; it is popped
+* and its parent is taken from the path rather than
+* read back from disk.
+*/
+int insert_into_parent(int table_id, path_t * path, pagenum_t left_num, int64_t key, pagenum_t right_num)
+{
+
+	int my_index;
+	pagenum_t parent_num;
+	page_t* parent;
+
+	path->depth--;
+
+	/* Case: new root. */
+
+	if ( path->depth == 0 )
+		return insert_into_new_root(table_id, left_num, key, right_num);
+
+	/* Case: leaf or node. (Remainder of
+	* function body.)
+	*/
+
+	/* The parent's pointer to the left node is
+	* the slot the descent took.
+	*/
+
+	parent_num = path->pagenum[path->depth - 1];
+	my_index = path->index[path->depth - 1] + 1;
+	parent = buf_get_page(table_id, parent_num);
+
+
+	/* Simple case: the new key fits into the node.
+	*/
+
+	if ( node_has_room(table_id, parent, key, key) )
+		return insert_into_node(parent, my_index, key, right_num);
+
+	/* Harder case:  split a node in order
+	* to preserve the B+ tree properties.
+	*/
+
+	return insert_into_node_after_splitting(table_id, path, parent, my_index, key, right_num);
+}
+
+
+/* Creates a new root for two subtrees
+* and inserts the appropriate key into
+* the new root.
+*/
+int insert_into_new_root(int table_id, pagenum_t left, int64_t key, pagenum_t right)
+{
+
+	pagenum_t root_num;
+	page_t * new_root = make_node(table_id, &root_num);
+
+	new_root->leftmost_child = left;
+	node_pack(new_root, &key, &right, 1);
+
+	set_root(table_id, root_num);
+	buf_put_page(new_root, true);
+
+	return 0;
+}
+
+
+
+/* First insertion:
+* start a new tree.
+*/
+int start_new_tree(int table_id, record_t* pointer)
+{
+
+	pagenum_t root_num;
+	page_t* root = make_leaf(table_id, &root_num);
+
+	leaf_insert_at(root, 0, pointer);
+	set_root(table_id, root_num);
+	buf_put_page(root, true); // update db_root_page
+	return 0;
+}
+
+
+
+/* Inserts a key and value as part of transaction
+* trx_id (0 for none), under an exclusive lock on
+* the key.
+* Returns 0 on success, 1 if the key exists or the
+* transaction was aborted (see record_lock).
+*/
+int db_insert(int table_id, int64_t key, char* value, int trx_id)
+{
+	trx_t implicit, * trx;
+	int result;
+
+	trx = record_lock(table_id, key, trx_id, LOCK_EXCLUSIVE, &implicit);
+	if ( trx == NULL )
+		return 1;
+	result = 1;
+	if ( log_undo(trx, UNDO_INSERT, table_id, key) )
+		result = insert_record(table_id, key, value);
+	trx_leave(trx);
+	return result;
+}
+
+/* Master insertion function.
+* Inserts a key and an associated value into
+* the B+ tree, causing the tree to be adjusted
+* however necessary to maintain the B+ tree
+* properties.
+*/
+int insert_record(int table_id, int64_t key, char* value)
+{
+
+	record_t record;
+	record_t * pointer = &record;
+	path_t path;
+	page_t * page;
+	int i, result = 0;
+
+	buf_begin_op();
+
+	/* Create a new record for the
+	* value.
+	*/
+	if ( make_record(table_id, pointer, key, value) )
+	{
+		buf_group_commit();
+		return 1;
+	}
+
+	/* Most inserts fit into their leaf, so the
+	* descent first latches only the leaf exclusively
+	* and falls back to keeping every page a split
+	* could reach.  Ascending keys skip the descent
+	* and go straight to the rightmost leaf.
+	*/
+	page = find_rightmost(table_id, key, &path, record_size(pointer));
+	if ( page == NULL )
+		page = find_leaf_for_update(table_id, key, &path, true, record_size(pointer), true);
+	if ( page == NULL )
+		page = find_leaf_for_update(table_id, key, &path, true, record_size(pointer), false);
+
+	/* Case: the tree does not exist yet.
+	* Start a new tree.
+	*/
+
+	if ( page == NULL )
+	{
+		start_new_tree(table_id, pointer);
+	}
+
+	/* Case: the tree already exists.
+	* (Rest of function body.)
+	* A single descent records the path; the
+	* leaf it ends in is checked for the key and
+	* modified in place, and the path stands in
+	* for parent lookups if the leaf splits.
+	*/
+
+	else
+	{
+		/* The current implementation ignores
+		* duplicates.
+		*/
+		i = leaf_search(page, key);
+		if ( i < page->num_keys && page->slots[i].key == key )
+		{
+			result = 1;
+		}
+
+		/* The descent keeps its own pin on the leaf;
+		* the insertion functions take and release
+		* another.
+		* Case: leaf has room for key and pointer.
+		*/
+
+		else if ( leaf_free(page) >= record_size(pointer) )
+		{
+			if ( page->right_sibling == 0 )
+				__atomic_store_n(&tables[table_id].rightmost, path.pagenum[path.depth - 1],
+								 __ATOMIC_RELEASE);
+			page = buf_get_page(table_id, path.pagenum[path.depth - 1]);
+			insert_into_leaf(page, pointer);
+			buf_put_page(page, true);
+		}
+
+		/* Case:  leaf must be split.
+		*/
+
+		else
+		{
+			page = buf_get_page(table_id, path.pagenum[path.depth - 1]);
+			insert_into_leaf_after_splitting(table_id, &path, page, pointer);
+		}
+	}
+	path_release(table_id, &path);
+	if ( result != 0 )
+		free_overflow(table_id, pointer->overflow);
 
-	/* Simple case: the new key fits into the node.
+	/* The insert becomes durable at the next
+	* (group) commit point.
 	*/
+	buf_group_commit();
+	return result;
+}
 
-	if ( parent->num_keys < 248 )
-		return insert_into_node(parent_num, my_index, key, right_num);
 
-	/* Harder case:  split a node in order
-	* to preserve the B+ tree properties.
+/* Inserts n keys and values as part of transaction
+* trx_id (0 for none).  Every key is locked before
+* anything is inserted.  The batch is then sorted and
+* cut into runs of keys that fall into one leaf: each
+* run is a single operation with a single descent,
+* and all of its records go into the leaf together.
+* A run ends early at a record that no longer fits,
+* which starts the next run and splits the leaf, or
+* at a value long enough to need overflow pages,
+* which are written before its own descent.
+* Keys already in the tree, repeated in the batch
+* (the first one counts) or with values longer than
+* MAX_VALUE_SIZE are skipped.  Whether a key is in
+* the tree is seen in its leaf, latched for the run:
+* the undo of an insertion is logged there, right
+* before it is made.
+* Returns the number of keys inserted, or -1 if
+* trx_id is not active or the transaction was
+* aborted on a lock, before anything was inserted.
+*/
+int db_insert_batch(int table_id, int64_t * keys, char ** values, int n, int trx_id)
+{
+	trx_t implicit, * trx;
+	int64_t (* entries)[2];
+	record_t record;
+	path_t path;
+	page_t * page, * leaf;
+	int i, j, k, m, inserted = 0;
+	bool dirty, split;
+
+	entries = malloc(sizeof(*entries) * (n > 0 ? n : 1));
+	if ( entries == NULL )
+	{
+		perror("Batch insert.");
+		exit(EXIT_FAILURE);
+	}
+	for ( i = 0; i < n; i++ )
+	{
+		entries[i][0] = keys[i];
+		entries[i][1] = i;
+	}
+	qsort(entries, n, sizeof(*entries), compare_entries);
+	for ( i = 0, m = 0; i < n; i++ )
+		if ( (i == 0 || entries[i][0] != entries[i - 1][0]) &&
+			strlen(values[entries[i][1]]) <= MAX_VALUE_SIZE )
+			memcpy(entries[m++], entries[i], sizeof(*entries));
+
+	/* Locks are taken in key order, as record_lock
+	* would one at a time, and all held to the end.
 	*/
+	trx = trx_enter(trx_id, &implicit);
+	if ( trx == NULL )
+	{
+		free(entries);
+		return -1;
+	}
+	for ( i = 0; i < m; i++ )
+	{
+		if ( lock_acquire(trx, table_id, entries[i][0], LOCK_EXCLUSIVE) == LOCK_DEADLOCK )
+		{
+			if ( trx_id == 0 )
+				trx_leave(trx);
+			else
+				trx_abort(trx_id);
+			free(entries);
+			return -1;
+		}
+	}
+
+	for ( i = 0; i < m; i = j )
+	{
+		buf_begin_op();
+		make_record(table_id, &record, entries[i][0], values[entries[i][1]]);
+		page = find_rightmost(table_id, record.key, &path, record_size(&record));
+		if ( page == NULL )
+			page = find_leaf_for_update(table_id, record.key, &path, true, record_size(&record), true);
+		if ( page == NULL )
+			page = find_leaf_for_update(table_id, record.key, &path, true, record_size(&record), false);
+		if ( page == NULL )
+		{
+			trx_add_undo(trx, UNDO_INSERT, table_id, record.key, NULL);
+			start_new_tree(table_id, &record);
+			inserted++;
+			j = i + 1;
+			path_release(table_id, &path);
+			buf_group_commit();
+			continue;
+		}
 
-	return insert_into_node_after_splitting(parent_num, my_index, key, right_num);
+		/* Only the first record of a run was
+		* descended for, so only it may split the
+		* leaf; the path holds what its split needs.
+		*/
+		leaf = buf_get_page(table_id, path.pagenum[path.depth - 1]);
+		dirty = split = false;
+		for ( j = i; ; )
+		{
+			k = leaf_search(leaf, record.key);
+			if ( k < leaf->num_keys && leaf->slots[k].key == record.key )
+				free_overflow(table_id, record.overflow);
+			else if ( leaf_free(leaf) >= record_size(&record) )
+			{
+				trx_add_undo(trx, UNDO_INSERT, table_id, record.key, NULL);
+				insert_into_leaf(leaf, &record);
+				dirty = true;
+				inserted++;
+			}
+			else if ( j == i )
+			{
+				trx_add_undo(trx, UNDO_INSERT, table_id, record.key, NULL);
+				insert_into_leaf_after_splitting(table_id, &path, leaf, &record);
+				split = true;
+				inserted++;
+			}
+			else
+				break;
+			j++;
+			if ( split || j == m || entries[j][0] >= path.high
+				 || strlen(values[entries[j][1]]) > LEAF_INLINE_MAX )
+				break;
+			make_record(table_id, &record, entries[j][0], values[entries[j][1]]);
+		}
+		if ( !split )
+		{
+			if ( dirty && leaf->right_sibling == 0 )
+				__atomic_store_n(&tables[table_id].rightmost, path.pagenum[path.depth - 1],
+								 __ATOMIC_RELEASE);
+			buf_put_page(leaf, dirty);
+		}
+		path_release(table_id, &path);
+		buf_group_commit();
+	}
+	trx_leave(trx);
+	free(entries);
+	return inserted;
 }
 
 
-/* Creates a new root for two subtrees
-* and inserts the appropriate key into
-* the new root.
+/* Changes the value of an existing key as part of
+* transaction trx_id (0 for none), under an
+* exclusive lock on the key.
+* Returns 0 on success, 1 if the key is not in the
+* tree or the transaction was aborted (see
+* record_lock).
 */
-int insert_into_new_root(pagenum_t left, int64_t key, pagenum_t right)
+int db_update(int table_id, int64_t key, char* value, int trx_id)
 {
+	trx_t implicit, * trx;
+	int result;
 
-	file_read_page(0, (page_t*)header);
-	page_t * new_root = make_node();
-	pagenum_t root_num = header->root = file_alloc_page();
+	trx = record_lock(table_id, key, trx_id, LOCK_EXCLUSIVE, &implicit);
+	if ( trx == NULL )
+		return 1;
+	result = 1;
+	if ( log_undo(trx, UNDO_UPDATE, table_id, key) )
+		result = update_record(table_id, key, value, NULL);
+	trx_leave(trx);
+	return result;
+}
 
-	new_root->branches[0].key = key;
-	new_root->branches[0].child = right;
-	new_root->leftmost_child = left;
-	new_root->num_keys++;
+/* Replaces the value of an existing key.  The
+* record is taken out of its leaf and the new one
+* put in its place, which may split the leaf if
+* the value grew, so the descent is the one an
+* insertion of the new record makes.  Most of the
+* time the leaf has room and is all that is
+* latched.  If old_value is not NULL, the value the
+* record held is copied there.
+* Returns 0 on success, 1 if the key is not in
+* the tree or the value is too long.
+*/
+int update_record(int table_id, int64_t key, char* value, char * old_value)
+{
+	path_t path;
+	page_t * leaf;
+	record_t record, old;
+	int i, result = 1;
 
-	page_t* left_page = (page_t*)malloc(sizeof(page_t));
-	page_t* right_page = (page_t*)malloc(sizeof(page_t));
-	file_read_page(left, left_page);
-	file_read_page(right, right_page);
-	left_page->parent = root_num;
-	right_page->parent = root_num;
+	buf_begin_op();
+	if ( make_record(table_id, &record, key, value) )
+	{
+		buf_group_commit();
+		return 1;
+	}
+	leaf = find_leaf_for_update(table_id, key, &path, true, record_size(&record), true);
+	if ( leaf == NULL )
+		leaf = find_leaf_for_update(table_id, key, &path, true, record_size(&record), false);
 
-	file_write_page(root_num, new_root);
-	file_write_page(0, (page_t*)header);
-	file_write_page(left, left_page);
-	file_write_page(right, right_page);
+	if ( leaf != NULL )
+	{
+		i = leaf_search(leaf, key);
+		if ( i < leaf->num_keys && leaf->slots[i].key == key )
+		{
+			if ( old_value != NULL )
+				read_value(table_id, leaf, i, old_value);
+			leaf_record(leaf, i, &old);
+			leaf = buf_get_page(table_id, path.pagenum[path.depth - 1]);
+			leaf_remove_at(leaf, i);
+			if ( leaf_free(leaf) >= record_size(&record) )
+			{
+				leaf_insert_at(leaf, i, &record);
+				buf_put_page(leaf, true);
+			}
+			else
+				insert_into_leaf_after_splitting(table_id, &path, leaf, &record);
+			free_overflow(table_id, old.overflow);
+			result = 0;
+		}
+	}
+	path_release(table_id, &path);
+	if ( result != 0 )
+		free_overflow(table_id, record.overflow);
 
-	return 0;
+	buf_group_commit();
+	return result;
 }
 
 
-
-/* First insertion:
-* start a new tree.
+/* Explicit commit point: every change made so far
+* to any open table is durable once this returns.
 */
-int start_new_tree(record_t* pointer)
+int db_commit(void)
 {
-
-	file_read_page(0, (page_t*)header);
-	page_t* root = make_leaf();
-	pagenum_t root_num = header->root = file_alloc_page();
-
-	root->records[0].key = pointer->key;
-	strcpy(root->records[0].value, pointer->value);
-	root->num_keys++;
-	file_write_page(root_num, root); // update db_root_page
-	file_write_page(0, (page_t*)header); // update header
-	free(root);
+	buf_commit();
 	return 0;
 }
 
 
+// BULK LOADING
 
-/* Master insertion function.
-* Inserts a key and an associated value into
-* the B+ tree, causing the tree to be adjusted
-* however necessary to maintain the B+ tree
-* properties.
+/* Orders (key, input position) pairs by key, then
+* by position, so sorting keeps equal keys in input
+* order.
 */
-int db_insert(int64_t key, char* value)
+int compare_entries(const void * a, const void * b)
 {
+	const int64_t * ea = (const int64_t *)a;
+	const int64_t * eb = (const int64_t *)b;
+	if ( ea[0] != eb[0] )
+		return ea[0] < eb[0] ? -1 : 1;
+	return (ea[1] > eb[1]) - (ea[1] < eb[1]);
+}
 
-	record_t * pointer;
-	pagenum_t leaf_page;
-
-	file_read_page(0, (page_t*)header);
+/* Number of nodes a level of m entries is packed
+* into at target entries per node, without leaving
+* any node of a multi-node level below minimum.
+*/
+int64_t level_nodes(int64_t m, int target, int minimum)
+{
+	int64_t nodes = (m + target - 1) / target;
+	if ( nodes > 1 && m / nodes < minimum )
+		nodes = m / minimum;
+	return nodes < 1 ? 1 : nodes;
+}
 
-	/* The current implementation ignores
-	* duplicates.
-	*/
-	char* temp = (char*)malloc(120);
-	if ( !db_find(key, temp) )
-		return 1;
+/* Entries given to node i when m entries are
+* spread evenly over nodes nodes.
+*/
+int level_share(int64_t m, int64_t nodes, int64_t i)
+{
+	return (int)(m / nodes + (i < m % nodes ? 1 : 0));
+}
 
-	/* Create a new record for the
-	* value.
-	*/
-	pointer = make_record(key, value);
+/* True if a level of m nodes, with first keys
+* first_keys, can be spread evenly over parents
+* parents that all fit the compact layout.
+*/
+static bool level_compact(const int64_t * first_keys, int64_t m, int64_t parents)
+{
+	int64_t p, c;
+	int count;
+	for ( p = 0, c = 0; p < parents; p++, c += count )
+	{
+		count = level_share(m, parents, p);
+		if ( count > COMPACT_ORDER
+			 || (count > 2 && !key_span_fits(first_keys[c + 1], first_keys[c + count - 1])) )
+			return false;
+	}
+	return true;
+}
 
-	/* Case: the tree does not exist yet.
-	* Start a new tree.
-	*/
+/* Fills in a record for db_bulk_load without writing
+* anything yet; its overflow pages are laid out by
+* the caller.
+*/
+static void stage_record(record_t * record, int64_t key, char * value)
+{
+	record->key = key;
+	record->length = strlen(value);
+	record->size = record->length <= LEAF_INLINE_MAX ? record->length : sizeof(pagenum_t);
+	record->data = value;
+	record->overflow = 0;
+}
 
-	if ( header->root == 0 )
-		return start_new_tree(pointer);
+// Overflow pages a value of length bytes takes.
+static int64_t overflow_pages(uint32_t length)
+{
+	return length > LEAF_INLINE_MAX ? (length + OVERFLOW_DATA_SIZE - 1) / OVERFLOW_DATA_SIZE : 0;
+}
 
+/* Writes a long value straight to the table as a
+* chain of overflow pages numbered from pagenum on.
+*/
+static void bulk_write_overflow(int table_id, pagenum_t pagenum, const char * value,
+								uint32_t length, overflow_page_t * page)
+{
+	uint32_t done, n;
+	for ( done = 0; done < length; done += n, pagenum++ )
+	{
+		n = length - done < OVERFLOW_DATA_SIZE ? length - done : OVERFLOW_DATA_SIZE;
+		memset(page, 0, sizeof(overflow_page_t));
+		memcpy(page->data, value + done, n);
+		page->next = done + n < length ? pagenum + 1 : 0;
+		file_write_page(table_id, pagenum, (page_t *)page);
+	}
+}
 
-	/* Case: the tree already exists.
-	* (Rest of function body.)
+/* Builds the tree bottom-up from n key/value pairs.
+* The input is sorted first unless it already is;
+* duplicate keys keep their first value, and values
+* longer than MAX_VALUE_SIZE are left out.
+* Leaves are filled to fill_factor percent of their
+* bytes and internal pages to fill_factor percent
+* of their entries (but never below the minimum
+* occupancy).  The overflow pages of long values
+* come first, then the leaves and the internal
+* levels, and every page is written exactly once,
+* in page-number order, straight to the table.
+* The new pages are unreachable until the header
+* names the new root, so they bypass the log; the
+* table is synced and the header checkpointed
+* at the end.
+* Only an empty tree is built this way; otherwise
+* the pairs go through db_insert_batch, which skips
+* the keys already in the table.
+* Returns 0 if the tree was built, 1 if the table
+* was not empty and the pairs were inserted instead,
+* or -1 if table_id is not open or the insertion
+* failed.
+*/
+int db_bulk_load(int table_id, int64_t * keys, char ** values, int n, int fill_factor)
+{
+	record_t * records;
+	record_t record;
+	int64_t (* entries)[2];
+	int64_t * first_keys, * leaf_start;
+	int64_t level_size[MAX_HEIGHT];
+	pagenum_t level_base[MAX_HEIGHT + 1];
+	pagenum_t overflow_base, overflow_num;
+	int64_t i, p, c, m, last;
+	int height, level, count, j, used, prev_used, size;
+	int leaf_target, internal_target, compact_target;
+	bool sorted = true, compact;
+	int64_t entry_keys[COMPACT_ORDER];
+	pagenum_t entry_children[COMPACT_ORDER];
+	page_t * page;
+
+	/* The root latch is held until the new root is
+	* installed, so nothing else can start using the
+	* table while it is being built.
 	*/
+	if ( !is_open_table(table_id) )
+		return -1;
+	pthread_rwlock_wrlock(&tables[table_id].root_latch);
+	if ( tables[table_id].header->root != 0 )
+	{
+		pthread_rwlock_unlock(&tables[table_id].root_latch);
+		return db_insert_batch(table_id, keys, values, n, 0) < 0 ? -1 : 1;
+	}
 
-	leaf_page = find_leaf(key);
-	page_t* page = (page_t*)malloc(sizeof(page_t));
-	file_read_page(leaf_page, page);
+	if ( fill_factor <= 0 || fill_factor > 100 )
+		fill_factor = DEFAULT_FILL_FACTOR;
+
+	records = (record_t *)malloc(sizeof(record_t) * (n > 0 ? n : 1));
+	if ( records == NULL || posix_memalign((void **)&page, 4096, sizeof(page_t)) )
+	{
+		perror("Bulk load.");
+		exit(EXIT_FAILURE);
+	}
+	for ( i = 1; i < n && sorted; i++ )
+		if ( keys[i - 1] >= keys[i] )
+			sorted = false;
+	if ( sorted )
+	{
+		for ( i = 0, m = 0; i < n; i++ )
+			if ( strlen(values[i]) <= MAX_VALUE_SIZE )
+				stage_record(&records[m++], keys[i], values[i]);
+	}
+	else
+	{
+		entries = malloc(sizeof(*entries) * n);
+		if ( entries == NULL )
+		{
+			perror("Bulk load.");
+			exit(EXIT_FAILURE);
+		}
+		for ( i = 0; i < n; i++ )
+		{
+			entries[i][0] = keys[i];
+			entries[i][1] = i;
+		}
+		qsort(entries, n, sizeof(*entries), compare_entries);
+		for ( i = 0, m = 0; i < n; i++ )
+			if ( (i == 0 || entries[i][0] != entries[i - 1][0]) &&
+				strlen(values[entries[i][1]]) <= MAX_VALUE_SIZE )
+				stage_record(&records[m++], keys[entries[i][1]], values[entries[i][1]]);
+		free(entries);
+	}
+	n = m;
+	if ( n == 0 )
+	{
+		pthread_rwlock_unlock(&tables[table_id].root_latch);
+		free(page);
+		free(records);
+		return 0;
+	}
 
-	/* Case: leaf has room for key and pointer.
+	/* Cut the records into leaves, each taking them
+	* while they fit in leaf_target bytes.  The last
+	* leaf gets what is left, so it borrows from the
+	* one before until the two are about even.
 	*/
+	leaf_start = (int64_t *)malloc(sizeof(int64_t) * (n + 1));
+	if ( leaf_start == NULL )
+	{
+		perror("Bulk load.");
+		exit(EXIT_FAILURE);
+	}
+	leaf_target = LEAF_DATA_SIZE * fill_factor / 100;
+	if ( leaf_target < LEAF_MIN_USED )
+		leaf_target = LEAF_MIN_USED;
+	level_size[0] = 0;
+	for ( i = 0, used = prev_used = 0; i < n; i++ )
+	{
+		if ( i == 0 || used + record_size(&records[i]) > leaf_target )
+		{
+			leaf_start[level_size[0]++] = i;
+			prev_used = used;
+			used = 0;
+		}
+		used += record_size(&records[i]);
+	}
+	leaf_start[level_size[0]] = n;
+	last = level_size[0] - 1;
+	while ( last > 0 && used < LEAF_MIN_USED )
+	{
+		size = record_size(&records[leaf_start[last] - 1]);
+		if ( used + size >= prev_used - size )
+			break;
+		leaf_start[last]--;
+		used += size;
+		prev_used -= size;
+	}
 
-	if ( page->num_keys < order - 1 )
+	/* Lay out the overflow pages, then the levels:
+	* leaves first, then each internal level up to a
+	* single root, with page numbers assigned
+	* consecutively from the end of the file.
+	*/
+	overflow_base = tables[table_id].header->num;
+	level_base[0] = overflow_base;
+	for ( i = 0; i < n; i++ )
+		level_base[0] += overflow_pages(records[i].length);
+	first_keys = (int64_t *)malloc(sizeof(int64_t) * level_size[0]);
+	if ( first_keys == NULL )
+	{
+		perror("Bulk load.");
+		exit(EXIT_FAILURE);
+	}
+	for ( p = 0; p < level_size[0]; p++ )
+		first_keys[p] = records[leaf_start[p]].key;
+
+	/* A level is packed at the compact target if
+	* every one of its nodes then fits the compact
+	* layout, and at the wide target otherwise.
+	* first_keys is narrowed to the first keys of
+	* each level on the way up; the loop writing the
+	* levels fills it in again.
+	*/
+	internal_target = INTERNAL_ORDER * fill_factor / 100;
+	compact_target = COMPACT_ORDER * fill_factor / 100;
+	compact = COMPACT_INTERNAL && level_base[0] + 2 * level_size[0] < COMPACT_MAX_PAGES;
+	for ( height = 0; level_size[height] > 1; height++ )
 	{
-		return insert_into_leaf(leaf_page, pointer);
+		if ( height + 1 == MAX_HEIGHT )
+		{
+			fprintf(stderr, "Tree deeper than %d levels.\n", MAX_HEIGHT);
+			exit(EXIT_FAILURE);
+		}
+		m = level_size[height];
+		level_size[height + 1] = level_nodes(m, compact_target, cut(INTERNAL_ORDER));
+		if ( !compact || !level_compact(first_keys, m, level_size[height + 1]) )
+			level_size[height + 1] = level_nodes(m, internal_target, cut(INTERNAL_ORDER));
+		for ( p = 0, c = 0; p < level_size[height + 1]; p++ )
+		{
+			first_keys[p] = first_keys[c];
+			c += level_share(m, level_size[height + 1], p);
+		}
 	}
+	for ( level = 0; level <= height; level++ )
+		level_base[level + 1] = level_base[level] + level_size[level];
 
+	for ( i = 0, overflow_num = overflow_base; i < n; i++ )
+	{
+		if ( records[i].length > LEAF_INLINE_MAX )
+		{
+			bulk_write_overflow(table_id, overflow_num, records[i].data, records[i].length,
+								(overflow_page_t *)page);
+			overflow_num += overflow_pages(records[i].length);
+		}
+	}
 
-	/* Case:  leaf must be split.
+	/* Each level is written left to right.  The
+	* children of every node are known in advance from
+	* the even split of the level below.
 	*/
+	overflow_num = overflow_base;
+	for ( level = 0; level <= height; level++ )
+	{
+		m = level == 0 ? n : level_size[level - 1];
+		for ( p = 0, c = 0; p < level_size[level]; p++ )
+		{
+			memset(page, 0, sizeof(page_t));
+			if ( level == 0 )
+			{
+				count = leaf_start[p + 1] - leaf_start[p];
+				leaf_init(page);
+				for ( j = 0; j < count; j++ )
+				{
+					record = records[c + j];
+					if ( record.length > LEAF_INLINE_MAX )
+					{
+						record.overflow = overflow_num;
+						record.data = (const char *)&record.overflow;
+						overflow_num += overflow_pages(record.length);
+					}
+					leaf_insert_at(page, j, &record);
+				}
+				page->right_sibling = p + 1 < level_size[0] ? level_base[0] + p + 1 : 0;
+				first_keys[p] = records[c].key;
+			}
+			else
+			{
+				count = level_share(m, level_size[level], p);
+				page->leftmost_child = level_base[level - 1] + c;
+				for ( j = 1; j < count; j++ )
+				{
+					entry_keys[j - 1] = first_keys[c + j];
+					entry_children[j - 1] = level_base[level - 1] + c + j;
+				}
+				node_pack(page, entry_keys, entry_children, count - 1);
+				first_keys[p] = first_keys[c];
+			}
+			file_write_page(table_id, level_base[level] + p, page);
+			c += count;
+		}
+	}
+	file_sync(table_id);
 
-	return insert_into_leaf_after_splitting(leaf_page, pointer);
+	/* No buffered page changed, so the header is
+	* made durable by a checkpoint of this table
+	* rather than a commit.
+	*/
+	buf_begin_op();
+	tables[table_id].header->num = level_base[height + 1];
+	set_root(table_id, level_base[height]);
+	buf_group_commit();
+	pthread_rwlock_unlock(&tables[table_id].root_latch);
+	buf_checkpoint(table_id);
+
+	free(leaf_start);
+	free(first_keys);
+	free(page);
+	free(records);
+	return 0;
 }
 
 
@@ -921,71 +2844,47 @@ int db_insert(int64_t key, char* value)
 * to the left if one exists.  If not (the node
 * is the leftmost child), returns -1 to signify
 * this special case.
+* The node is the last page on path, so the answer
+* is the slot its parent was left through: -1 for
+* leftmost_child, i for children[i], whose left
+* neighbor is leftmost_child (i == 0) or
+* children[i - 1].
 */
-int get_neighbor_index(node * n)
+int get_neighbor_index(path_t * path)
 {
-
-	int i;
-
-	/* Return the index of the key to the left
-	* of the pointer in the parent pointing
-	* to n.
-	* If n is the leftmost child, this means
-	* return -1.
-	*/
-	for ( i = 0; i <= n->parent->num_keys; i++ )
-		if ( n->parent->pointers[i] == n )
-			return i - 1;
-
-	// Error state.
-	printf("Search for nonexistent pointer to node in parent.\n");
-	printf("Node:  %#lx\n", (unsigned long)n);
-	exit(EXIT_FAILURE);
+	return path->index[path->depth - 2];
 }
 
 
-node * remove_entry_from_node(node * n, int key, node * pointer)
+/* Removes the key at index (and, in an internal
+* node, the pointer to its right) from a node,
+* shifting the following entries down.
+*/
+void remove_entry_from_node(page_t * n, int index)
 {
+	int64_t keys[COMPACT_ORDER];
+	pagenum_t children[COMPACT_ORDER];
+	int num_keys, num_moved = n->num_keys - index - 1;
 
-	int i, num_pointers;
-
-	// Remove the key and shift other keys accordingly.
-	i = 0;
-	while ( n->keys[i] != key )
-		i++;
-	for ( ++i; i < n->num_keys; i++ )
-		n->keys[i - 1] = n->keys[i];
-
-	// Remove the pointer and shift other pointers accordingly.
-	// First determine number of pointers.
-	num_pointers = n->is_leaf ? n->num_keys : n->num_keys + 1;
-	i = 0;
-	while ( n->pointers[i] != pointer )
-		i++;
-	for ( ++i; i < num_pointers; i++ )
-		n->pointers[i - 1] = n->pointers[i];
+	if ( n->is_leaf )
+	{
+		leaf_remove_at(n, index);
+		return;
+	}
 
+	num_keys = node_unpack(n, keys, children);
+	memmove(&keys[index], &keys[index + 1], sizeof(int64_t) * num_moved);
+	memmove(&children[index], &children[index + 1],
+			sizeof(pagenum_t) * num_moved);
 
 	// One key fewer.
-	n->num_keys--;
-
-	// Set the other pointers to NULL for tidiness.
-	// A leaf uses the last pointer to point to the next leaf.
-	if ( n->is_leaf )
-		for ( i = n->num_keys; i < order - 1; i++ )
-			n->pointers[i] = NULL;
-	else
-		for ( i = n->num_keys + 1; i < order; i++ )
-			n->pointers[i] = NULL;
-
-	return n;
+	node_pack(n, keys, children, num_keys - 1);
 }
 
 
-node * adjust_root(node * root)
+int adjust_root(int table_id, page_t * root)
 {
-
-	node * new_root;
+	pagenum_t root_num = tables[table_id].header->root;
 
 	/* Case: nonempty root.
 	* Key and pointer have already been deleted,
@@ -993,7 +2892,10 @@ node * adjust_root(node * root)
 	*/
 
 	if ( root->num_keys > 0 )
-		return root;
+	{
+		buf_put_page(root, true);
+		return 0;
+	}
 
 	/* Case: empty root.
 	*/
@@ -1004,21 +2906,21 @@ node * adjust_root(node * root)
 
 	if ( !root->is_leaf )
 	{
-		new_root = root->pointers[0];
-		new_root->parent = NULL;
+		set_root(table_id, root->leftmost_child);
 	}
 
 	// If it is a leaf (has no children),
 	// then the whole tree is empty.
 
 	else
-		new_root = NULL;
+		set_root(table_id, 0);
 
-	free(root->keys);
-	free(root->pointers);
-	free(root);
+	if ( root->is_leaf )
+		forget_rightmost(table_id, root_num);
+	buf_put_page(root, false);
+	buf_free_page(table_id, root_num);
 
-	return new_root;
+	return 0;
 }
 
 
@@ -1027,12 +2929,22 @@ node * adjust_root(node * root)
 * with a neighboring node that
 * can accept the additional entries
 * without exceeding the maximum.
+* n and neighbor arrive pinned and are released
+* here, and so is the neighbor's latch; the emptied
+* right-hand page goes back on the free list.
 */
-node * coalesce_nodes(node * root, node * n, node * neighbor, int neighbor_index, int k_prime)
+int coalesce_nodes(int table_id, path_t * path, page_t * n, page_t * neighbor,
+				   pagenum_t neighbor_num, int neighbor_index, int64_t k_prime)
 {
 
 	int i, j, neighbor_insertion_index, n_end;
-	node * tmp;
+	int64_t keys[COMPACT_ORDER];
+	pagenum_t children[COMPACT_ORDER];
+	record_t record;
+	page_t * tmp;
+	page_t * latched = neighbor;
+	pagenum_t n_num = path->pagenum[path->depth - 1];
+	pagenum_t tmp_num;
 
 	/* Swap neighbor with node if node is on the
 	* extreme left and neighbor is to its right.
@@ -1043,6 +2955,9 @@ node * coalesce_nodes(node * root, node * n, node * neighbor, int neighbor_index
 		tmp = n;
 		n = neighbor;
 		neighbor = tmp;
+		tmp_num = n_num;
+		n_num = neighbor_num;
+		neighbor_num = tmp_num;
 	}
 
 	/* Starting point in the neighbor for copying
@@ -1064,34 +2979,19 @@ node * coalesce_nodes(node * root, node * n, node * neighbor, int neighbor_index
 		/* Append k_prime.
 		*/
 
-		neighbor->keys[neighbor_insertion_index] = k_prime;
-		neighbor->num_keys++;
+		node_unpack(neighbor, keys, children);
+		keys[neighbor_insertion_index] = k_prime;
+		children[neighbor_insertion_index] = n->leftmost_child;
 
 
 		n_end = n->num_keys;
 
 		for ( i = neighbor_insertion_index + 1, j = 0; j < n_end; i++, j++ )
 		{
-			neighbor->keys[i] = n->keys[j];
-			neighbor->pointers[i] = n->pointers[j];
-			neighbor->num_keys++;
-			n->num_keys--;
-		}
-
-		/* The number of pointers is always
-		* one more than the number of keys.
-		*/
-
-		neighbor->pointers[i] = n->pointers[j];
-
-		/* All children must now point up to the same parent.
-		*/
-
-		for ( i = 0; i < neighbor->num_keys + 1; i++ )
-		{
-			tmp = (node *)neighbor->pointers[i];
-			tmp->parent = neighbor;
+			keys[i] = node_key(n, j);
+			children[i] = node_child(n, j);
 		}
+		node_pack(neighbor, keys, children, i);
 	}
 
 	/* In a leaf, append the keys and pointers of
@@ -1102,35 +3002,113 @@ node * coalesce_nodes(node * root, node * n, node * neighbor, int neighbor_index
 
 	else
 	{
-		for ( i = neighbor_insertion_index, j = 0; j < n->num_keys; i++, j++ )
+		for ( j = 0; j < n->num_keys; j++ )
 		{
-			neighbor->keys[i] = n->keys[j];
-			neighbor->pointers[i] = n->pointers[j];
-			neighbor->num_keys++;
+			leaf_record(n, j, &record);
+			leaf_insert_at(neighbor, neighbor->num_keys, &record);
 		}
-		neighbor->pointers[order - 1] = n->pointers[order - 1];
+		neighbor->right_sibling = n->right_sibling;
+		forget_rightmost(table_id, n_num);
 	}
 
-	root = delete_entry(root, n->parent, k_prime, n);
-	free(n->keys);
-	free(n->pointers);
-	free(n);
-	return root;
+	buf_unlatch_page(latched);
+	buf_put_page(neighbor, true);
+	buf_put_page(n, false);
+	buf_free_page(table_id, n_num);
+
+	/* Remove k_prime and the pointer to the
+	* emptied right-hand node from the parent.
+	*/
+
+	path->depth--;
+	page_t* parent = buf_get_page(table_id, path->pagenum[path->depth - 1]);
+	return delete_entry(table_id, path, parent, neighbor_index == -1 ? 0 : neighbor_index);
+}
+
+
+/* Number of records to move from the near end of
+* a neighbor leaf into leaf n, which is below
+* LEAF_MIN_USED: as many as keep n the smaller of
+* the two while it stays below.
+*/
+static int leaf_moves(page_t * n, page_t * neighbor, bool from_right)
+{
+	int moves = 0, used = leaf_used(n), neighbor_used = leaf_used(neighbor), size;
+	while ( used < LEAF_MIN_USED && moves < neighbor->num_keys )
+	{
+		size = (int)sizeof(slot_t)
+			   + neighbor->slots[from_right ? moves : neighbor->num_keys - 1 - moves].size;
+		if ( used + size >= neighbor_used - size )
+			break;
+		used += size;
+		neighbor_used -= size;
+		moves++;
+	}
+	return moves;
 }
 
+// Moves that many records from a neighbor leaf into leaf n.
+static void redistribute_leaves(page_t * n, page_t * neighbor, bool from_right, int moves)
+{
+	record_t record;
+	while ( moves-- > 0 )
+	{
+		leaf_record(neighbor, from_right ? 0 : neighbor->num_keys - 1, &record);
+		leaf_insert_at(n, from_right ? n->num_keys : 0, &record);
+		leaf_remove_at(neighbor, from_right ? 0 : neighbor->num_keys - 1);
+	}
+}
 
 /* Redistributes entries between two nodes when
 * one has become too small after deletion
 * but its neighbor is too big to append the
 * small node's entries without exceeding the
 * maximum
+* The separator in the parent changes, and a full
+* compact parent may have no room for the new one;
+* then nothing moves and n is left below the
+* minimum, which costs space but not correctness.
+* n and neighbor arrive pinned and are released here,
+* and so is the neighbor's latch.
 */
-node * redistribute_nodes(node * root, node * n, node * neighbor, int neighbor_index,
-						  int k_prime_index, int k_prime)
+int redistribute_nodes(int table_id, path_t * path, page_t * n, page_t * neighbor, int neighbor_index,
+					   int k_prime_index, int64_t k_prime)
 {
 
-	int i;
-	node * tmp;
+	int moves, num_keys;
+	int64_t keys[COMPACT_ORDER];
+	pagenum_t children[COMPACT_ORDER];
+	page_t* parent = buf_get_page(table_id, path->pagenum[path->depth - 2]);
+
+	/* Leaves move records by bytes rather than one
+	* at a time, and the separator in the parent
+	* becomes the first key of the right-hand leaf.
+	*/
+
+	if ( n->is_leaf )
+	{
+		moves = leaf_moves(n, neighbor, neighbor_index == -1);
+		if ( moves > 0
+			 && node_set_key(parent, k_prime_index, neighbor_index == -1
+							 ? neighbor->slots[moves].key
+							 : neighbor->slots[neighbor->num_keys - moves].key) )
+			redistribute_leaves(n, neighbor, neighbor_index == -1, moves);
+		buf_put_page(parent, true);
+		buf_unlatch_page(neighbor);
+		buf_put_page(neighbor, true);
+		buf_put_page(n, true);
+		return 0;
+	}
+
+	if ( !node_set_key(parent, k_prime_index, node_key(neighbor, neighbor_index != -1
+														 ? neighbor->num_keys - 1 : 0)) )
+	{
+		buf_put_page(parent, false);
+		buf_unlatch_page(neighbor);
+		buf_put_page(neighbor, false);
+		buf_put_page(n, true);
+		return 0;
+	}
 
 	/* Case: n has a neighbor to the left.
 	* Pull the neighbor's last key-pointer pair over
@@ -1139,29 +3117,13 @@ node * redistribute_nodes(node * root, node * n, node * neighbor, int neighbor_i
 
 	if ( neighbor_index != -1 )
 	{
-		if ( !n->is_leaf )
-			n->pointers[n->num_keys + 1] = n->pointers[n->num_keys];
-		for ( i = n->num_keys; i > 0; i-- )
-		{
-			n->keys[i] = n->keys[i - 1];
-			n->pointers[i] = n->pointers[i - 1];
-		}
-		if ( !n->is_leaf )
-		{
-			n->pointers[0] = neighbor->pointers[neighbor->num_keys];
-			tmp = (node *)n->pointers[0];
-			tmp->parent = n;
-			neighbor->pointers[neighbor->num_keys] = NULL;
-			n->keys[0] = k_prime;
-			n->parent->keys[k_prime_index] = neighbor->keys[neighbor->num_keys - 1];
-		}
-		else
-		{
-			n->pointers[0] = neighbor->pointers[neighbor->num_keys - 1];
-			neighbor->pointers[neighbor->num_keys - 1] = NULL;
-			n->keys[0] = neighbor->keys[neighbor->num_keys - 1];
-			n->parent->keys[k_prime_index] = n->keys[0];
-		}
+		num_keys = node_unpack(n, keys + 1, children + 1);
+		children[0] = n->leftmost_child;
+		keys[0] = k_prime;
+		n->leftmost_child = node_child(neighbor, neighbor->num_keys - 1);
+		node_pack(n, keys, children, num_keys + 1);
+		num_keys = node_unpack(neighbor, keys, children);
+		node_pack(neighbor, keys, children, num_keys - 1);
 	}
 
 	/* Case: n is the leftmost child.
@@ -1172,63 +3134,53 @@ node * redistribute_nodes(node * root, node * n, node * neighbor, int neighbor_i
 
 	else
 	{
-		if ( n->is_leaf )
-		{
-			n->keys[n->num_keys] = neighbor->keys[0];
-			n->pointers[n->num_keys] = neighbor->pointers[0];
-			n->parent->keys[k_prime_index] = neighbor->keys[1];
-		}
-		else
-		{
-			n->keys[n->num_keys] = k_prime;
-			n->pointers[n->num_keys + 1] = neighbor->pointers[0];
-			tmp = (node *)n->pointers[n->num_keys + 1];
-			tmp->parent = n;
-			n->parent->keys[k_prime_index] = neighbor->keys[0];
-		}
-		for ( i = 0; i < neighbor->num_keys - 1; i++ )
-		{
-			neighbor->keys[i] = neighbor->keys[i + 1];
-			neighbor->pointers[i] = neighbor->pointers[i + 1];
-		}
-		if ( !n->is_leaf )
-			neighbor->pointers[i] = neighbor->pointers[i + 1];
+		num_keys = node_unpack(n, keys, children);
+		keys[num_keys] = k_prime;
+		children[num_keys] = neighbor->leftmost_child;
+		node_pack(n, keys, children, num_keys + 1);
+		num_keys = node_unpack(neighbor, keys, children);
+		neighbor->leftmost_child = children[0];
+		node_pack(neighbor, keys + 1, children + 1, num_keys - 1);
 	}
 
 	/* n now has one more key and one more pointer;
 	* the neighbor has one fewer of each.
 	*/
 
-	n->num_keys++;
-	neighbor->num_keys--;
+	buf_put_page(parent, true);
+	buf_unlatch_page(neighbor);
+	buf_put_page(neighbor, true);
+	buf_put_page(n, true);
 
-	return root;
+	return 0;
 }
 
 
 /* Deletes an entry from the B+ tree.
-* Removes the record and its key and pointer
-* from the leaf, and then makes all appropriate
+* Removes the entry at index from n, the pinned
+* last page on path, and then makes all appropriate
 * changes to preserve the B+ tree properties.
 */
-node * delete_entry(node * root, node * n, int key, void * pointer)
+int delete_entry(int table_id, path_t * path, page_t * n, int index)
 {
 
 	int min_keys;
-	node * neighbor;
+	page_t * neighbor, * parent;
+	pagenum_t neighbor_num;
 	int neighbor_index;
-	int k_prime_index, k_prime;
+	int k_prime_index;
+	int64_t k_prime;
 	int capacity;
 
 	// Remove key and pointer from node.
 
-	n = remove_entry_from_node(n, key, pointer);
+	remove_entry_from_node(n, index);
 
 	/* Case:  deletion from the root.
 	*/
 
-	if ( n == root )
-		return adjust_root(root);
+	if ( path->depth == 1 )
+		return adjust_root(table_id, n);
 
 
 	/* Case:  deletion from a node below the root.
@@ -1239,14 +3191,17 @@ node * delete_entry(node * root, node * n, int key, void * pointer)
 	* to be preserved after deletion.
 	*/
 
-	min_keys = n->is_leaf ? cut(order - 1) : cut(order) - 1;
+	min_keys = cut(INTERNAL_ORDER) - 1;
 
 	/* Case:  node stays at or above minimum.
 	* (The simple case.)
 	*/
 
-	if ( n->num_keys >= min_keys )
-		return root;
+	if ( n->is_leaf ? leaf_used(n) >= LEAF_MIN_USED : n->num_keys >= min_keys )
+	{
+		buf_put_page(n, true);
+		return 0;
+	}
 
 	/* Case:  node falls below minimum.
 	* Either coalescence or redistribution
@@ -1260,64 +3215,100 @@ node * delete_entry(node * root, node * n, int key, void * pointer)
 	* to the neighbor.
 	*/
 
-	neighbor_index = get_neighbor_index(n);
+	neighbor_index = get_neighbor_index(path);
 	k_prime_index = neighbor_index == -1 ? 0 : neighbor_index;
-	k_prime = n->parent->keys[k_prime_index];
-	neighbor = neighbor_index == -1 ? n->parent->pointers[1] :
-		n->parent->pointers[neighbor_index];
+	parent = buf_get_page(table_id, path->pagenum[path->depth - 2]);
+	k_prime = node_key(parent, k_prime_index);
+	neighbor_num = node_child(parent, neighbor_index == -1 ? 0 : neighbor_index - 1);
+	buf_put_page(parent, false);
+	neighbor = buf_get_page(table_id, neighbor_num);
+
+	/* n's parent is latched, so no other writer can
+	* reach the neighbor.  Scans latch leaves left to
+	* right, so a leaf lets go of n while it latches its
+	* left neighbor; only readers can get at n meanwhile.
+	*/
+	if ( n->is_leaf && neighbor_index != -1 )
+	{
+		buf_unlatch_page(n);
+		buf_latch_page(neighbor, true);
+		buf_latch_page(n, true);
+	}
+	else
+		buf_latch_page(neighbor, true);
 
-	capacity = n->is_leaf ? order : order - 1;
+	capacity = INTERNAL_ORDER - 1;
 
 	/* Coalescence. */
 
-	if ( neighbor->num_keys + n->num_keys < capacity )
-		return coalesce_nodes(root, n, neighbor, neighbor_index, k_prime);
+	if ( n->is_leaf ? leaf_used(neighbor) + leaf_used(n) <= LEAF_DATA_SIZE
+		 : neighbor->num_keys + n->num_keys < capacity )
+		return coalesce_nodes(table_id, path, n, neighbor, neighbor_num, neighbor_index, k_prime);
 
 	/* Redistribution. */
 
 	else
-		return redistribute_nodes(root, n, neighbor, neighbor_index, k_prime_index, k_prime);
+		return redistribute_nodes(table_id, path, n, neighbor, neighbor_index, k_prime_index, k_prime);
 }
 
 
 
-/* Master deletion function.
+/* Deletes a key as part of transaction trx_id
+* (0 for none), under an exclusive lock on the key.
+* Returns 0 if the key was deleted, 1 if it was not
+* in the tree or the transaction was aborted (see
+* record_lock).
 */
-node * delete(node * root, int key)
+int db_delete(int table_id, int64_t key, int trx_id)
 {
+	trx_t implicit, * trx;
+	int result;
 
-	node * key_leaf;
-	record * key_record;
-
-	key_record = find(root, key, false);
-	key_leaf = find_leaf(root, key, false);
-	if ( key_record != NULL && key_leaf != NULL )
-	{
-		root = delete_entry(root, key_leaf, key, key_record);
-		free(key_record);
-	}
-	return root;
+	trx = record_lock(table_id, key, trx_id, LOCK_EXCLUSIVE, &implicit);
+	if ( trx == NULL )
+		return 1;
+	result = 1;
+	if ( log_undo(trx, UNDO_DELETE, table_id, key) )
+		result = delete_record(table_id, key, NULL);
+	trx_leave(trx);
+	return result;
 }
 
-
-void destroy_tree_nodes(node * root)
+/* Master deletion function.
+* If old_value is not NULL, the value the record
+* held is copied there.
+* Returns 0 if the key was deleted, 1 if it
+* was not in the tree.
+*/
+int delete_record(int table_id, int64_t key, char * old_value)
 {
-	int i;
-	if ( root->is_leaf )
-		for ( i = 0; i < root->num_keys; i++ )
-			free(root->pointers[i]);
-	else
-		for ( i = 0; i < root->num_keys + 1; i++ )
-			destroy_tree_nodes(root->pointers[i]);
-	free(root->pointers);
-	free(root->keys);
-	free(root);
-}
 
+	path_t path;
+	page_t * leaf;
+	record_t record;
+	int i, result = 1;
 
-node * destroy_tree(node * root)
-{
-	destroy_tree_nodes(root);
-	return NULL;
-}
+	buf_begin_op();
+	leaf = find_leaf_for_update(table_id, key, &path, false, 0, true);
+	if ( leaf == NULL )
+		leaf = find_leaf_for_update(table_id, key, &path, false, 0, false);
+
+	if ( leaf != NULL )
+	{
+		i = leaf_search(leaf, key);
+		if ( i < leaf->num_keys && leaf->slots[i].key == key )
+		{
+			if ( old_value != NULL )
+				read_value(table_id, leaf, i, old_value);
+			leaf_record(leaf, i, &record);
+			leaf = buf_get_page(table_id, path.pagenum[path.depth - 1]);
+			delete_entry(table_id, &path, leaf, i);
+			free_overflow(table_id, record.overflow);
+			result = 0;
+		}
+	}
+	path_release(table_id, &path);
 
+	buf_group_commit();
+	return result;
+}
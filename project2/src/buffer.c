@@ -0,0 +1,1320 @@
+#define _GNU_SOURCE
+#include "buffer.h"
+#include "log.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static buffer_t* buffers = NULL;
+static page_t* frames = NULL;
+static int buf_num = 0;
+
+static buffer_t** hash_table = NULL;
+static int hash_size = 0;
+
+// Next frame the clock hand looks at for a victim.
+static int clock_hand = 0;
+
+// Operations finished since the last commit.
+static int pending_ops = 0;
+
+// Operations started and not yet finished.
+static int active_ops = 0;
+
+// Frames holding changes not yet in the log.
+static int unlogged_frames = 0;
+
+/* Threads waiting for or reaping read-ahead
+* completions without pool_lock: a table's io_uring
+* is not torn down under them (see close_table).
+*/
+static int reapers = 0;
+
+/* pool_lock guards everything above and the control
+* blocks (flags and hash links), and the free and
+* num fields of table headers.  A cache hit takes
+* none of it: it finds the frame through the hash
+* table and pins it with atomics (see pin_cached).
+* Page contents are guarded by the frame latches.
+* No disk transfer or log sync is waited for while
+* holding it: the frame involved is claimed
+* (is_busy) and the lock let go meanwhile.
+* evict_cond is signalled whenever a frame that
+* could not be evicted may have become evictable,
+* and op_cond whenever an operation ends.
+* commit_latch is held shared by every writing
+* operation and exclusively by commits, so a commit
+* only ever sees whole operations.
+*/
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t evict_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t op_cond = PTHREAD_COND_INITIALIZER;
+static pthread_rwlock_t commit_latch;
+
+/* The background flusher writes logged dirty frames
+* just ahead of the clock hand, so eviction, which
+* only takes clean frames, seldom has to wait for
+* it, and takes the checkpoints.  It
+* sleeps on flusher_cond (with pool_lock) between
+* rounds; the flags below, guarded by pool_lock, wake
+* it early.  flush_lock is held by whoever writes
+* frames back outside the flusher's rounds, so an
+* older image it is writing cannot land on top of a
+* newer one.  Lock order: commit_latch, flush_lock,
+* pool_lock.
+*/
+static pthread_t flusher;
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool flusher_stop = false;
+static bool flush_wanted = false;
+static bool checkpoint_wanted = false;
+
+// Copies of the frames of a flusher round.
+static page_t* flush_images = NULL;
+
+// Log size of each table right after its last background checkpoint.
+static int64_t checkpointed_size[MAX_TABLES + 1];
+
+static void commit_all(void);
+static void commit_group(int table_id);
+static void checkpoint_table(int table_id);
+static void fuzzy_checkpoint(int table_id);
+static void* flusher_main(void* arg);
+
+
+static int hash_index(int table_id, pagenum_t pagenum)
+{
+	return (int)((pagenum * MAX_TABLES + table_id) % hash_size);
+}
+
+/* The hash chains are changed under pool_lock but
+* walked without it by cache hits, so their links
+* are stored atomically.  Frames are never freed, so
+* a walk that follows a frame onto another chain
+* only misses; it is cut off after buf_num steps in
+* case it keeps being moved.
+*/
+static void hash_insert(buffer_t* buf)
+{
+	int h = hash_index(buf->table_id, buf->pagenum);
+	__atomic_store_n(&buf->hash_next, hash_table[h], __ATOMIC_RELAXED);
+	__atomic_store_n(&hash_table[h], buf, __ATOMIC_RELEASE);
+}
+
+static void hash_remove(buffer_t* buf)
+{
+	buffer_t** c = &hash_table[hash_index(buf->table_id, buf->pagenum)];
+	while ( *c != NULL && *c != buf )
+	{
+		c = &(*c)->hash_next;
+	}
+	if ( *c != NULL )
+	{
+		__atomic_store_n(c, buf->hash_next, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&buf->hash_next, NULL, __ATOMIC_RELEASE);
+}
+
+static buffer_t* hash_find(int table_id, pagenum_t pagenum)
+{
+	buffer_t* c = __atomic_load_n(&hash_table[hash_index(table_id, pagenum)], __ATOMIC_ACQUIRE);
+	int steps;
+	for ( steps = 0; c != NULL && steps < buf_num; steps++ )
+	{
+		if ( __atomic_load_n(&c->pagenum, __ATOMIC_RELAXED) == pagenum &&
+			__atomic_load_n(&c->table_id, __ATOMIC_RELAXED) == table_id )
+			return c;
+		c = __atomic_load_n(&c->hash_next, __ATOMIC_ACQUIRE);
+	}
+	return NULL;
+}
+
+/* Gives a claimed frame to pagenum, unread.  The
+* page is named with atomic stores, as hash_find
+* reads it without pool_lock.
+*/
+static void assign_frame(buffer_t* buf, int table_id, pagenum_t pagenum)
+{
+	__atomic_store_n(&buf->table_id, table_id, __ATOMIC_RELAXED);
+	__atomic_store_n(&buf->pagenum, pagenum, __ATOMIC_RELAXED);
+	__atomic_store_n(&buf->is_valid, true, __ATOMIC_RELAXED);
+	buf->is_dirty = false;
+	buf->is_logged = true;
+	buf->is_flushing = false;
+	buf->is_referenced = true;
+	hash_insert(buf);
+}
+
+/* Claims an unpinned frame for the caller alone, so
+* pool_lock can be let go while its page is read or
+* written: a busy frame is not pinned, evicted or
+* claimed again until release_frame.  Returns false
+* if the frame is in use.  Called with pool_lock
+* held.
+* Pins are taken without the lock, so is_busy is
+* set before pin_count is checked again, while a
+* pin is counted before is_busy is checked (see
+* pin_cached): one of the two sides always sees the
+* other and backs off.
+*/
+static bool claim_frame(buffer_t* buf)
+{
+	if ( __atomic_load_n(&buf->pin_count, __ATOMIC_SEQ_CST) > 0 || buf->is_busy )
+		return false;
+	__atomic_store_n(&buf->is_busy, true, __ATOMIC_SEQ_CST);
+	if ( __atomic_load_n(&buf->pin_count, __ATOMIC_SEQ_CST) == 0 )
+		return true;
+	__atomic_store_n(&buf->is_busy, false, __ATOMIC_SEQ_CST);
+	return false;
+}
+
+// Ends a claim and wakes whoever waits for the frame.
+static void release_frame(buffer_t* buf)
+{
+	__atomic_store_n(&buf->is_busy, false, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&buf->ready);
+	pthread_cond_broadcast(&evict_cond);
+}
+
+// Publishes a read-ahead frame whose read is done.
+static void finish_read(buffer_t* buf)
+{
+	// No writer holds a page that was on disk.
+	buf->frame->version &= ~(uint64_t)1;
+	buf->is_reading = false;
+	release_frame(buf);
+}
+
+/* Waits for the read of a read-ahead frame with
+* pool_lock let go and publishes the frame.  It is
+* pinned meanwhile, so it is not claimed again once
+* someone else has published it.  Called with
+* pool_lock held.
+*/
+static void wait_read(buffer_t* buf)
+{
+	__atomic_add_fetch(&buf->pin_count, 1, __ATOMIC_SEQ_CST);
+	reapers++;
+	pthread_mutex_unlock(&pool_lock);
+	file_wait_read(buf->table_id, &buf->read);
+	pthread_mutex_lock(&pool_lock);
+	reapers--;
+	if ( buf->is_reading )
+		finish_read(buf);
+	__atomic_sub_fetch(&buf->pin_count, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&evict_cond);
+}
+
+/* Publishes the read-ahead frames of a table (0:
+* of every table) whose reads have finished.
+* Completions are reaped with pool_lock let go, but
+* the device is not waited for.  Called with
+* pool_lock held.
+*/
+static void reap_reads(int table_id)
+{
+	bool reading[MAX_TABLES + 1];
+	bool any = false;
+	int i;
+
+	memset(reading, 0, sizeof(reading));
+	for ( i = 0; i < buf_num; i++ )
+	{
+		if ( buffers[i].is_reading && (table_id == 0 || buffers[i].table_id == table_id) )
+			any = reading[buffers[i].table_id] = true;
+	}
+	if ( !any )
+		return;
+	reapers++;
+	pthread_mutex_unlock(&pool_lock);
+	for ( i = 1; i <= MAX_TABLES; i++ )
+	{
+		if ( reading[i] )
+			file_reap_reads(i);
+	}
+	pthread_mutex_lock(&pool_lock);
+	reapers--;
+	for ( i = 0; i < buf_num; i++ )
+	{
+		if ( buffers[i].is_reading && __atomic_load_n(&buffers[i].read.done, __ATOMIC_ACQUIRE) )
+			finish_read(&buffers[i]);
+	}
+	pthread_cond_broadcast(&evict_cond);
+}
+
+/* True if a dirty frame may be written to the
+* table: its latest image is in the log (its page
+* lsn) and the log is synced past it, so the table
+* never gets a change of a group that might not
+* commit.
+*/
+static bool is_flushable(buffer_t* buf)
+{
+	return buf->is_valid && buf->is_dirty && buf->is_logged && !buf->is_busy &&
+		buf->frame->lsn < log_synced_lsn(buf->table_id);
+}
+
+// Orders frames by table and then file position.
+static int compare_frames(const void* a, const void* b)
+{
+	const buffer_t* x = *(buffer_t* const*)a;
+	const buffer_t* y = *(buffer_t* const*)b;
+	if ( x->table_id != y->table_id )
+		return x->table_id < y->table_id ? -1 : 1;
+	return x->pagenum < y->pagenum ? -1 : x->pagenum > y->pagenum;
+}
+
+/* Writes back every dirty frame of a table whose
+* oldest logged change is older than before (0:
+* every one), FLUSH_BATCH at a time in file order
+* as a flusher round does: the images are copied
+* under pool_lock and written without it.  Unless
+* quiesced (commit_latch held exclusively, so no
+* page is being changed) a frame is claimed while it
+* is copied, and one in use is left dirty.
+* Called with flush_lock held, which keeps
+* flush_images, and without pool_lock.
+*/
+static void write_frames(int table_id, uint64_t before, bool quiesced)
+{
+	buffer_t* batch[FLUSH_BATCH];
+	pagenum_t pagenums[FLUSH_BATCH];
+	page_t* images[FLUSH_BATCH];
+	buffer_t* c;
+	int i = 0, j, k, n;
+
+	pthread_mutex_lock(&pool_lock);
+	while ( i < buf_num )
+	{
+		for ( n = 0; i < buf_num && n < FLUSH_BATCH; i++ )
+		{
+			c = &buffers[i];
+			if ( is_flushable(c) && c->table_id == table_id &&
+				(before == 0 || (c->rec_lsn != 0 && c->rec_lsn < before)) )
+				batch[n++] = c;
+		}
+		qsort(batch, n, sizeof(buffer_t*), compare_frames);
+		for ( j = 0, k = 0; j < n; j++ )
+		{
+			c = batch[j];
+			if ( !quiesced && !claim_frame(c) )
+				continue;
+			memcpy(&flush_images[k], c->frame, sizeof(page_t));
+			__atomic_add_fetch(&c->pin_count, 1, __ATOMIC_SEQ_CST);
+			c->is_flushing = true;
+			if ( !quiesced )
+				release_frame(c);
+			pagenums[k] = c->pagenum;
+			images[k] = &flush_images[k];
+			batch[k++] = c;
+		}
+		if ( k == 0 )
+			continue;
+		pthread_mutex_unlock(&pool_lock);
+		file_write_pages(table_id, pagenums, images, k);
+		pthread_mutex_lock(&pool_lock);
+		for ( j = 0; j < k; j++ )
+		{
+			if ( batch[j]->is_flushing )
+			{
+				batch[j]->is_dirty = false;
+				batch[j]->rec_lsn = 0;
+				batch[j]->is_flushing = false;
+			}
+			__atomic_sub_fetch(&batch[j]->pin_count, 1, __ATOMIC_RELEASE);
+		}
+		pthread_cond_broadcast(&evict_cond);
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/* Returns a frame that can be evicted now: unpinned,
+* not busy, clean, and not used since the clock hand
+* last passed it.  The hand clears the use bit
+* (is_referenced) of the frames it passes, so a frame
+* in use lasts a full turn.  Dirty frames are left
+* to the flusher.
+*/
+static buffer_t* find_unpinned(void)
+{
+	buffer_t* c;
+	int i;
+	for ( i = 0; i < 2 * buf_num; i++ )
+	{
+		c = &buffers[clock_hand];
+		clock_hand = (clock_hand + 1) % buf_num;
+		if ( __atomic_load_n(&c->pin_count, __ATOMIC_ACQUIRE) > 0 || c->is_busy || c->is_dirty )
+			continue;
+		if ( c->is_valid && __atomic_load_n(&c->is_referenced, __ATOMIC_RELAXED) )
+		{
+			__atomic_store_n(&c->is_referenced, false, __ATOMIC_RELAXED);
+			continue;
+		}
+		return c;
+	}
+	return NULL;
+}
+
+/* True if some frame is, or will become, evictable
+* without the caller's help: one in flight, pinned
+* by a flusher round, or unpinned and not holding
+* uncommitted changes.  A dirty one is written back
+* by the flusher once the log is synced past it; a
+* clean one may have been freed while pool_lock was
+* let go.  Uncommitted changes wait for the end of
+* every operation in progress, the caller's too.
+*/
+static bool frame_pending(void)
+{
+	int i;
+	for ( i = 0; i < buf_num; i++ )
+	{
+		if ( buffers[i].is_busy || buffers[i].is_flushing ||
+			(__atomic_load_n(&buffers[i].pin_count, __ATOMIC_ACQUIRE) == 0 &&
+			 (!buffers[i].is_dirty || buffers[i].is_logged)) )
+			return true;
+	}
+	return false;
+}
+
+/* Picks a clean victim with the clock
+* (find_unpinned) and returns it claimed and
+* invalid, out of the hash table.  Eviction never
+* writes a page itself: with no clean frame to take
+* it wakes the flusher, which scans the whole pool
+* then, and waits for it to write some back.
+* Nothing is committed here: the caller is in the
+* middle of an operation, and buf_begin_op keeps
+* enough frames free of uncommitted changes for
+* every operation in progress.
+* With pages being read ahead, the read of one of
+* them is waited for instead.
+* Called with pool_lock held; lets go of it while
+* waiting for a read.
+*/
+static buffer_t* find_victim(void)
+{
+	buffer_t* c;
+	int i;
+	for ( ;; )
+	{
+		c = find_unpinned();
+		if ( c != NULL && claim_frame(c) )
+			break;
+		if ( c != NULL )
+			continue;
+		if ( !frame_pending() )
+		{
+			fprintf(stderr, "Buffer pool exhausted: all %d frames are pinned.\n", buf_num);
+			exit(EXIT_FAILURE);
+		}
+		// A read-ahead frame is only published once someone looks.
+		for ( i = 0; i < buf_num && !buffers[i].is_reading; i++ )
+			;
+		if ( i < buf_num )
+		{
+			wait_read(&buffers[i]);
+			continue;
+		}
+		// The flusher is behind; have it catch up.
+		flush_wanted = true;
+		pthread_cond_signal(&flusher_cond);
+		pthread_cond_wait(&evict_cond, &pool_lock);
+	}
+	if ( c->is_valid )
+	{
+		hash_remove(c);
+		__atomic_store_n(&c->is_valid, false, __ATOMIC_RELAXED);
+	}
+	return c;
+}
+
+/* Pins the frame holding pagenum, loading it
+* from disk on a miss unless the caller is about
+* to overwrite the whole page anyway.
+* The page is read with pool_lock let go and its
+* frame claimed; others wanting it wait for it, or
+* for its read if it is being read ahead.
+* Called with pool_lock held.
+*/
+static buffer_t* pin_frame(int table_id, pagenum_t pagenum, bool load)
+{
+	buffer_t* buf;
+	for ( ;; )
+	{
+		buf = hash_find(table_id, pagenum);
+		if ( buf != NULL && !buf->is_busy )
+			break;
+		if ( buf != NULL && buf->is_reading )
+		{
+			wait_read(buf);
+			continue;
+		}
+		if ( buf != NULL )
+		{
+			pthread_cond_wait(&buf->ready, &pool_lock);
+			continue;
+		}
+		buf = find_victim();
+		// Someone else may have brought the page in meanwhile.
+		if ( hash_find(table_id, pagenum) != NULL )
+		{
+			release_frame(buf);
+			continue;
+		}
+		assign_frame(buf, table_id, pagenum);
+		if ( load )
+		{
+			pthread_mutex_unlock(&pool_lock);
+			file_read_page(table_id, pagenum, buf->frame);
+			// No writer holds a page that was on disk.
+			buf->frame->version &= ~(uint64_t)1;
+			pthread_mutex_lock(&pool_lock);
+		}
+		release_frame(buf);
+		break;
+	}
+	__atomic_add_fetch(&buf->pin_count, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&buf->is_referenced, true, __ATOMIC_RELAXED);
+	return buf;
+}
+
+/* Pins the frame holding pagenum if it is in the
+* pool and ready, without pool_lock.  The frame is
+* found through the hash table, pinned, and only
+* then checked to hold the page: from then on it
+* cannot be claimed (see claim_frame), so it keeps
+* it.  The use bit is only written if it was clear,
+* so a hot page costs no store to shared memory
+* other than its pin count.
+* Returns NULL if pin_frame has to be used instead.
+*/
+static buffer_t* pin_cached(int table_id, pagenum_t pagenum)
+{
+	buffer_t* buf = hash_find(table_id, pagenum);
+	if ( buf == NULL )
+		return NULL;
+	__atomic_add_fetch(&buf->pin_count, 1, __ATOMIC_SEQ_CST);
+	if ( __atomic_load_n(&buf->is_busy, __ATOMIC_SEQ_CST) ||
+		!__atomic_load_n(&buf->is_valid, __ATOMIC_RELAXED) ||
+		__atomic_load_n(&buf->pagenum, __ATOMIC_RELAXED) != pagenum ||
+		__atomic_load_n(&buf->table_id, __ATOMIC_RELAXED) != table_id )
+	{
+		__atomic_sub_fetch(&buf->pin_count, 1, __ATOMIC_RELEASE);
+		return NULL;
+	}
+	if ( !__atomic_load_n(&buf->is_referenced, __ATOMIC_RELAXED) )
+		__atomic_store_n(&buf->is_referenced, true, __ATOMIC_RELAXED);
+	return buf;
+}
+
+/* Drops every cached page of a table, which
+* checkpoint_table has written back.  Called with
+* pool_lock held.
+*/
+static void invalidate_table(int table_id)
+{
+	int i;
+	for ( i = 0; i < buf_num; i++ )
+	{
+		if ( buffers[i].is_valid && buffers[i].table_id == table_id )
+		{
+			hash_remove(&buffers[i]);
+			__atomic_store_n(&buffers[i].is_valid, false, __ATOMIC_RELAXED);
+			buffers[i].is_dirty = false;
+			buffers[i].rec_lsn = 0;
+			__atomic_store_n(&buffers[i].pin_count, 0, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+
+/* Allocates the buffer pool with num_buf frames.
+* Returns 0 on success, -1 otherwise.
+*/
+int init_db(int num_buf)
+{
+	int i;
+
+	if ( buffers != NULL )
+	{
+		shutdown_db();
+	}
+	if ( num_buf <= 0 )
+	{
+		num_buf = DEFAULT_BUF_NUM;
+	}
+
+	pthread_rwlockattr_t attr;
+
+	hash_size = num_buf * 2 + 1;
+	hash_table = (buffer_t**)calloc(hash_size, sizeof(buffer_t*));
+	buffers = NULL;
+	frames = flush_images = NULL;
+	if ( posix_memalign((void**)&buffers, 64, sizeof(buffer_t) * num_buf) || hash_table == NULL ||
+		posix_memalign((void**)&frames, 4096, sizeof(page_t) * num_buf) ||
+		posix_memalign((void**)&flush_images, 4096, sizeof(page_t) * FLUSH_BATCH) )
+	{
+		free(buffers);
+		free(hash_table);
+		free(frames);
+		buffers = NULL;
+		hash_table = NULL;
+		frames = NULL;
+		return -1;
+	}
+	memset(buffers, 0, sizeof(buffer_t) * num_buf);
+	buf_num = num_buf;
+	unlogged_frames = 0;
+	// Page versions start out even (unlatched).
+	memset(frames, 0, sizeof(page_t) * num_buf);
+
+	clock_hand = 0;
+	for ( i = 0; i < num_buf; i++ )
+	{
+		buffers[i].frame = &frames[i];
+		buffers[i].is_logged = true;
+		pthread_rwlock_init(&buffers[i].latch, NULL);
+		pthread_cond_init(&buffers[i].ready, NULL);
+	}
+
+	/* Prefer the committer so a steady stream of
+	* operations cannot starve it.
+	*/
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&commit_latch, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	flusher_stop = flush_wanted = checkpoint_wanted = false;
+	memset(checkpointed_size, 0, sizeof(checkpointed_size));
+	if ( pthread_create(&flusher, NULL, flusher_main, NULL) )
+	{
+		perror("Flusher creation.");
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
+
+/* Closes every open table and releases
+* the buffer pool.
+*/
+int shutdown_db(void)
+{
+	int table_id;
+	if ( buffers == NULL )
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&pool_lock);
+	flusher_stop = true;
+	pthread_cond_signal(&flusher_cond);
+	pthread_mutex_unlock(&pool_lock);
+	pthread_join(flusher, NULL);
+	for ( table_id = 1; table_id <= MAX_TABLES; table_id++ )
+	{
+		close_table(table_id);
+	}
+	for ( table_id = 0; table_id < buf_num; table_id++ )
+	{
+		pthread_rwlock_destroy(&buffers[table_id].latch);
+		pthread_cond_destroy(&buffers[table_id].ready);
+	}
+	pthread_rwlock_destroy(&commit_latch);
+	free(buffers);
+	free(frames);
+	free(flush_images);
+	free(hash_table);
+	buffers = NULL;
+	frames = NULL;
+	flush_images = NULL;
+	hash_table = NULL;
+	buf_num = 0;
+	return 0;
+}
+
+/* Flushes and forgets the pages of a table
+* and closes its file.  The file is closed before
+* commit_latch is let go, so the flusher never
+* checkpoints a table on its way out, and once
+* nobody is still reading ahead into the pool
+* through its io_uring.
+*/
+int close_table(int table_id)
+{
+	int i;
+	if ( !is_open_table(table_id) )
+	{
+		return -1;
+	}
+	if ( buffers == NULL )
+	{
+		file_close_table(table_id);
+		return 0;
+	}
+	pthread_rwlock_wrlock(&commit_latch);
+	pthread_mutex_lock(&flush_lock);
+	pthread_mutex_lock(&pool_lock);
+	for ( i = 0; i < buf_num; i++ )
+	{
+		if ( buffers[i].is_reading && buffers[i].table_id == table_id )
+			wait_read(&buffers[i]);
+	}
+	while ( reapers > 0 )
+		pthread_cond_wait(&evict_cond, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+	checkpoint_table(table_id);
+	pthread_mutex_lock(&pool_lock);
+	invalidate_table(table_id);
+	checkpointed_size[table_id] = 0;
+	pthread_mutex_unlock(&pool_lock);
+	pthread_mutex_unlock(&flush_lock);
+	file_close_table(table_id);
+	pthread_rwlock_unlock(&commit_latch);
+	return 0;
+}
+
+/* Returns a pinned in-pool image of pagenum.
+* The caller must hand it back with buf_put_page.
+* Pinning only keeps the frame in the pool; reading
+* or changing the page also needs its latch.
+* A page in the pool is pinned without pool_lock.
+*/
+page_t* buf_get_page(int table_id, pagenum_t pagenum)
+{
+	buffer_t* buf = pin_cached(table_id, pagenum);
+	if ( buf == NULL )
+	{
+		pthread_mutex_lock(&pool_lock);
+		buf = pin_frame(table_id, pagenum, true);
+		pthread_mutex_unlock(&pool_lock);
+	}
+	return buf->frame;
+}
+
+/* Unpins a page obtained from buf_get_page,
+* marking it dirty if the caller modified it.
+* Only marking it dirty takes pool_lock.
+*/
+void buf_put_page(page_t* page, bool is_dirty)
+{
+	buffer_t* buf = &buffers[page - frames];
+	if ( !is_dirty )
+	{
+		__atomic_sub_fetch(&buf->pin_count, 1, __ATOMIC_RELEASE);
+		return;
+	}
+	pthread_mutex_lock(&pool_lock);
+	if ( buf->is_logged )
+		unlogged_frames++;
+	buf->is_dirty = true;
+	buf->is_logged = false;
+	buf->is_flushing = false;
+	__atomic_sub_fetch(&buf->pin_count, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/* Latches a pinned page, shared for reading or
+* exclusive for writing.  The caller keeps the pin
+* until it has released the latch.
+* An exclusive latch makes the page version odd
+* until it is released, which tells optimistic
+* readers to wait and invalidates what they read.
+*/
+void buf_latch_page(page_t* page, bool exclusive)
+{
+	buffer_t* buf = &buffers[page - frames];
+	if ( exclusive )
+	{
+		pthread_rwlock_wrlock(&buf->latch);
+		__atomic_store_n(&page->version, page->version + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+	else
+		pthread_rwlock_rdlock(&buf->latch);
+}
+
+void buf_unlatch_page(page_t* page)
+{
+	if ( page->version & 1 )
+		__atomic_store_n(&page->version, page->version + 1, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&buffers[page - frames].latch);
+}
+
+/* Starts reading a pinned page and returns its
+* version.  A latched reader takes the shared latch;
+* an optimistic one takes nothing, waits out a writer
+* holding the page, and must check what it read with
+* buf_read_valid before trusting it.
+*/
+uint64_t buf_read_begin(page_t* page, bool latched)
+{
+	uint64_t version;
+	if ( latched )
+		pthread_rwlock_rdlock(&buffers[page - frames].latch);
+	while ( (version = __atomic_load_n(&page->version, __ATOMIC_ACQUIRE)) & 1 )
+		sched_yield();
+	return version;
+}
+
+/* Returns true if no writer changed the page since
+* buf_read_begin returned version.
+*/
+bool buf_read_valid(page_t* page, uint64_t version)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&page->version, __ATOMIC_RELAXED) == version;
+}
+
+void buf_read_end(page_t* page, bool latched)
+{
+	if ( latched )
+		pthread_rwlock_unlock(&buffers[page - frames].latch);
+}
+
+/* Allocates a page and returns its pinned,
+* zeroed frame.
+* The free list is walked through the pool so that
+* its links are logged like any other page change;
+* only a page taken from the end of the file is
+* pinned without reading it.
+* The head of the free list is checked again once
+* its page is pinned, as reading it lets go of
+* pool_lock.
+* The new page is unreachable until the caller links
+* it into the tree, so it is handed out unlatched.
+* Its version carries on from the frame's previous
+* image so stale optimistic readers still notice.
+*/
+page_t* buf_alloc_page(int table_id, pagenum_t* pagenum)
+{
+	header_page_t* header = tables[table_id].header;
+	buffer_t* buf;
+	uint64_t version;
+	pthread_mutex_lock(&pool_lock);
+	for ( ;; )
+	{
+		*pagenum = header->free;
+		if ( *pagenum == 0 )
+		{
+			*pagenum = file_alloc_page(table_id);
+			buf = pin_frame(table_id, *pagenum, false);
+			break;
+		}
+		buf = pin_frame(table_id, *pagenum, true);
+		if ( header->free == *pagenum )
+		{
+			header->free = buf->frame->next_free;
+			break;
+		}
+		__atomic_sub_fetch(&buf->pin_count, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	version = buf->frame->version;
+	memset(buf->frame, 0, sizeof(page_t));
+	__atomic_store_n(&buf->frame->version, version + 2, __ATOMIC_RELEASE);
+	return buf->frame;
+}
+
+/* Puts a page on the free list.  Its old contents
+* are dead; only the next_free link and the version
+* are kept.
+*/
+void buf_free_page(int table_id, pagenum_t pagenum)
+{
+	header_page_t* header = tables[table_id].header;
+	page_t* page;
+	uint64_t version;
+	pthread_mutex_lock(&pool_lock);
+	page = pin_frame(table_id, pagenum, false)->frame;
+	version = page->version;
+	memset(page, 0, sizeof(page_t));
+	__atomic_store_n(&page->version, version + 2, __ATOMIC_RELEASE);
+	page->next_free = header->free;
+	header->free = pagenum;
+	pthread_mutex_unlock(&pool_lock);
+	buf_put_page(page, true);
+}
+
+/* Logs the image of every page of a table changed
+* since the previous commit together with its header.
+* No operation is in progress, so every image is
+* whole.  log_commit then makes the group durable
+* with a single sync.  The pages themselves reach
+* the table lazily, once that sync is done
+* (is_flushable).
+*/
+static void commit_group(int table_id)
+{
+	int i;
+	uint64_t lsn;
+	for ( i = 0; i < buf_num; i++ )
+	{
+		if ( buffers[i].is_valid && !buffers[i].is_logged &&
+			buffers[i].table_id == table_id )
+		{
+			lsn = log_append_page(table_id, buffers[i].pagenum, buffers[i].frame);
+			if ( buffers[i].rec_lsn == 0 )
+				buffers[i].rec_lsn = lsn;
+			buffers[i].is_logged = true;
+			unlogged_frames--;
+		}
+	}
+	log_append_page(table_id, 0, (page_t*)tables[table_id].header);
+}
+
+/* Commits every table with changed pages or with
+* transaction records in its log; only those pay for
+* a log sync, since every header change comes with a
+* dirty page.  Called with commit_latch held
+* exclusively and pool_lock held, which is let go
+* while the logs sync.
+* A table whose log has grown by LOG_CHECKPOINT_SIZE
+* since its last checkpoint has the flusher take the
+* next one.
+*/
+static void commit_all(void)
+{
+	bool changed[MAX_TABLES + 1] = { false };
+	int i, table_id;
+
+	pending_ops = 0;
+	for ( i = 0; i < buf_num; i++ )
+	{
+		if ( buffers[i].is_valid && !buffers[i].is_logged )
+		{
+			changed[buffers[i].table_id] = true;
+		}
+	}
+	for ( table_id = 1; table_id <= MAX_TABLES; table_id++ )
+	{
+		changed[table_id] = changed[table_id] || (is_open_table(table_id) && log_pending(table_id));
+		if ( changed[table_id] )
+			commit_group(table_id);
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+	for ( table_id = 1; table_id <= MAX_TABLES; table_id++ )
+	{
+		if ( changed[table_id] )
+			log_commit(table_id);
+	}
+	pthread_mutex_lock(&pool_lock);
+	pthread_cond_broadcast(&evict_cond);
+
+	for ( table_id = 1; table_id <= MAX_TABLES; table_id++ )
+	{
+		if ( changed[table_id] && log_size(table_id) >= LOG_CHECKPOINT_SIZE )
+		{
+			checkpoint_wanted = true;
+			pthread_cond_signal(&flusher_cond);
+		}
+	}
+}
+
+/* Explicit commit point.  Everything done so far
+* survives a crash once this returns.
+* Must not be called inside an operation.
+*/
+void buf_commit(void)
+{
+	pthread_rwlock_wrlock(&commit_latch);
+	pthread_mutex_lock(&pool_lock);
+	commit_all();
+	pthread_mutex_unlock(&pool_lock);
+	pthread_rwlock_unlock(&commit_latch);
+}
+
+/* True if the pool lacks room for one more
+* operation: the frames holding uncommitted changes
+* and OP_MAX_FRAMES for each operation in progress
+* and the new one must fit in it.
+* Called with pool_lock held.
+*/
+static bool pool_full(void)
+{
+	return unlogged_frames + (active_ops + 1) * OP_MAX_FRAMES > buf_num;
+}
+
+/* Starts a writing operation, which ends with
+* buf_group_commit.  Operations do not nest.
+* A commit only ever sees whole operations, so
+* frames cannot be freed of uncommitted changes
+* while one is in progress.  An operation is
+* therefore only started while the pool has room
+* for it (pool_full); otherwise it waits for those
+* in progress to end and commits first.  A pool too
+* small for even one runs them one at a time.
+*/
+void buf_begin_op(void)
+{
+	pthread_mutex_lock(&pool_lock);
+	while ( pool_full() && (active_ops > 0 || unlogged_frames > 0) )
+	{
+		if ( active_ops > 0 )
+		{
+			pthread_cond_wait(&op_cond, &pool_lock);
+			continue;
+		}
+		pthread_mutex_unlock(&pool_lock);
+		buf_commit();
+		pthread_mutex_lock(&pool_lock);
+	}
+	active_ops++;
+	pthread_mutex_unlock(&pool_lock);
+	pthread_rwlock_rdlock(&commit_latch);
+}
+
+/* Marks the end of one operation.  Operations are
+* committed in groups of GROUP_COMMIT_SIZE so the log
+* sync is paid once per batch instead of per write.
+* A group is cut short once half the pool holds
+* uncommitted changes, so that operations seldom
+* have to wait in buf_begin_op.
+*/
+void buf_group_commit(void)
+{
+	bool commit;
+	pthread_rwlock_unlock(&commit_latch);
+	pthread_mutex_lock(&pool_lock);
+	active_ops--;
+	pthread_cond_broadcast(&op_cond);
+	commit = ++pending_ops >= GROUP_COMMIT_SIZE || unlogged_frames * 2 >= buf_num;
+	pthread_mutex_unlock(&pool_lock);
+	if ( commit )
+	{
+		buf_commit();
+	}
+}
+
+/* Commits a table, writes its dirty pages and its
+* header back, syncs it and checkpoints its log,
+* which empties it unless transactions are open.
+* The log sync and the writes are done without
+* pool_lock.  Called with commit_latch held
+* exclusively and flush_lock held.
+*/
+static void checkpoint_table(int table_id)
+{
+	header_page_t header;
+
+	if ( !is_open_table(table_id) )
+	{
+		return;
+	}
+	pthread_mutex_lock(&pool_lock);
+	commit_group(table_id);
+	memcpy(&header, tables[table_id].header, sizeof(header));
+	pthread_mutex_unlock(&pool_lock);
+	log_commit(table_id);
+	write_frames(table_id, 0, true);
+	file_write_page(table_id, 0, (page_t*)&header);
+	file_sync(table_id);
+	log_checkpoint(table_id, 0);
+}
+
+/* Checkpoints a table without stopping for all of
+* its dirty pages, or stopping operations for any of
+* them.  commit_latch is only held while the table's
+* group is committed and its header copied: the
+* lsn of that header image marks the point redo may
+* have to start from.  The log is then synced and
+* the pages whose oldest logged change predates the
+* previous checkpoint written back with operations
+* running, which bounds what restart has to redo to
+* about two checkpoint intervals while hot pages
+* keep collecting changes in the pool.  Redo starts
+* at the oldest change still only in the log, or at
+* the mark.
+* Called with flush_lock held, and returns with
+* commit_latch (held exclusively on entry) let go.
+*/
+static void fuzzy_checkpoint(int table_id)
+{
+	uint64_t previous = log_checkpoint_lsn(table_id);
+	uint64_t redo_lsn;
+	header_page_t header;
+	int i;
+
+	pthread_mutex_lock(&pool_lock);
+	commit_group(table_id);
+	memcpy(&header, tables[table_id].header, sizeof(header));
+	pthread_mutex_unlock(&pool_lock);
+	pthread_rwlock_unlock(&commit_latch);
+
+	log_commit(table_id);
+	if ( previous != 0 )
+		write_frames(table_id, previous, false);
+	redo_lsn = header.lsn;
+	pthread_mutex_lock(&pool_lock);
+	for ( i = 0; i < buf_num; i++ )
+	{
+		if ( buffers[i].is_valid && buffers[i].table_id == table_id && buffers[i].rec_lsn != 0 &&
+			buffers[i].rec_lsn < redo_lsn )
+		{
+			redo_lsn = buffers[i].rec_lsn;
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+	file_write_page(table_id, 0, (page_t*)&header);
+	file_sync(table_id);
+	log_checkpoint(table_id, redo_lsn);
+}
+
+void buf_checkpoint(int table_id)
+{
+	pthread_rwlock_wrlock(&commit_latch);
+	pthread_mutex_lock(&flush_lock);
+	checkpoint_table(table_id);
+	pthread_mutex_unlock(&flush_lock);
+	pthread_rwlock_unlock(&commit_latch);
+}
+
+/* One round of the flusher.  Takes the writable
+* frames (is_flushable) among the half of the pool
+* the clock hand reaches next (with whole, the whole
+* pool from there), up to FLUSH_BATCH and
+* a quarter of the pool, copies them while they are
+* claimed (so no writer is in the middle of them)
+* and writes the copies in file order, runs of
+* adjacent pages together, without holding
+* pool_lock.  Frames stay pinned meanwhile so
+* they are not evicted.  A frame
+* changed during the write keeps its dirty bit.
+* Returns true if the round was full.
+*/
+static bool flush_round(bool whole)
+{
+	buffer_t* batch[FLUSH_BATCH];
+	pagenum_t pagenums[FLUSH_BATCH];
+	page_t* images[FLUSH_BATCH];
+	buffer_t* c;
+	int i, j, n = 0, limit, scanned;
+
+	pthread_mutex_lock(&flush_lock);
+	pthread_mutex_lock(&pool_lock);
+	limit = buf_num / 4 < FLUSH_BATCH ? buf_num / 4 : FLUSH_BATCH;
+	if ( limit == 0 )
+		limit = 1;
+	for ( scanned = 0; n < limit && scanned < (whole ? buf_num : buf_num / 2); scanned++ )
+	{
+		c = &buffers[(clock_hand + scanned) % buf_num];
+		if ( is_flushable(c) && __atomic_load_n(&c->pin_count, __ATOMIC_ACQUIRE) == 0 )
+			batch[n++] = c;
+	}
+	qsort(batch, n, sizeof(buffer_t*), compare_frames);
+	for ( i = 0, j = 0; i < n; i++ )
+	{
+		c = batch[i];
+		if ( !claim_frame(c) )
+			continue;
+		memcpy(&flush_images[j], c->frame, sizeof(page_t));
+		__atomic_add_fetch(&c->pin_count, 1, __ATOMIC_SEQ_CST);
+		c->is_flushing = true;
+		release_frame(c);
+		pagenums[j] = c->pagenum;
+		images[j] = &flush_images[j];
+		batch[j++] = c;
+	}
+	n = j;
+	pthread_mutex_unlock(&pool_lock);
+
+	for ( i = 0; i < n; i = j )
+	{
+		for ( j = i + 1; j < n && batch[j]->table_id == batch[i]->table_id; j++ )
+			;
+		file_write_pages(batch[i]->table_id, &pagenums[i], &images[i], j - i);
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	for ( i = 0; i < n; i++ )
+	{
+		if ( batch[i]->is_flushing )
+		{
+			batch[i]->is_dirty = false;
+			batch[i]->rec_lsn = 0;
+			batch[i]->is_flushing = false;
+		}
+		__atomic_sub_fetch(&batch[i]->pin_count, 1, __ATOMIC_RELEASE);
+	}
+	pthread_cond_broadcast(&evict_cond);
+	pthread_mutex_unlock(&pool_lock);
+	pthread_mutex_unlock(&flush_lock);
+	return n > 0 && n == limit;
+}
+
+/* Checkpoints every table whose log grew since the
+* flusher last checkpointed it (by
+* LOG_CHECKPOINT_SIZE, unless forced by the timer),
+* one at a time with fuzzy_checkpoint.  Most pages
+* old enough to be written by it have been written
+* by flusher rounds already.
+* commit_latch is only tried, never waited for: an
+* operation holding it may itself be waiting for a
+* flusher round (see find_victim), and a writer
+* queued on it would hold up every operation
+* starting meanwhile.
+* Returns false if the rest was left for later.
+*/
+static bool background_checkpoint(bool timed)
+{
+	int table_id = 1;
+	int64_t size;
+
+	while ( table_id <= MAX_TABLES )
+	{
+		if ( pthread_rwlock_trywrlock(&commit_latch) )
+			return false;
+		pthread_mutex_lock(&flush_lock);
+		for ( ; table_id <= MAX_TABLES; table_id++ )
+		{
+			if ( !is_open_table(table_id) || tables[table_id].header == NULL )
+				continue;
+			size = log_size(table_id);
+			if ( size >= LOG_CHECKPOINT_SIZE || (timed && size > checkpointed_size[table_id]) )
+				break;
+		}
+		if ( table_id > MAX_TABLES )
+		{
+			pthread_mutex_unlock(&flush_lock);
+			pthread_rwlock_unlock(&commit_latch);
+			break;
+		}
+		fuzzy_checkpoint(table_id);
+		checkpointed_size[table_id] = log_size(table_id);
+		pthread_mutex_unlock(&flush_lock);
+		table_id++;
+	}
+	return true;
+}
+
+/* Body of the flusher thread.  Every
+* FLUSH_INTERVAL_MS, or when woken, it runs rounds
+* until one comes back short (at most a pool's
+* worth), over the whole pool if eviction is waiting
+* for it, and every CHECKPOINT_INTERVAL_MS, or when
+* a commit asks for it, checkpoints.  A checkpoint
+* that found commit_latch taken is tried again after
+* CHECKPOINT_RETRY_MS.
+*/
+static void* flusher_main(void* arg)
+{
+	struct timespec deadline, now, last;
+	int rounds;
+	bool checkpoint, timed, whole, retry = false;
+
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	pthread_mutex_lock(&pool_lock);
+	while ( !flusher_stop )
+	{
+		if ( !flush_wanted && (!checkpoint_wanted || retry) )
+		{
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += (retry ? CHECKPOINT_RETRY_MS : FLUSH_INTERVAL_MS) * 1000000L;
+			deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+			deadline.tv_nsec %= 1000000000L;
+			pthread_cond_timedwait(&flusher_cond, &pool_lock, &deadline);
+			if ( flusher_stop )
+				break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timed = (now.tv_sec - last.tv_sec) * 1000 + (now.tv_nsec - last.tv_nsec) / 1000000
+			>= CHECKPOINT_INTERVAL_MS;
+		checkpoint = timed || checkpoint_wanted;
+		whole = flush_wanted;
+		flush_wanted = checkpoint_wanted = false;
+		reap_reads(0);
+		pthread_mutex_unlock(&pool_lock);
+
+		for ( rounds = 0; rounds <= buf_num / FLUSH_BATCH && flush_round(whole); rounds++ )
+			;
+		retry = checkpoint && !background_checkpoint(timed);
+		if ( checkpoint && !retry && timed )
+			last = now;
+		pthread_mutex_lock(&pool_lock);
+		checkpoint_wanted = checkpoint_wanted || retry;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return NULL;
+}
+
+/* Starts reading pages of a direct table, which has
+* no page cache to read ahead into, straight into
+* clean unpinned frames with one batch, and returns
+* without waiting for it: the frames stay claimed
+* (is_reading) until whoever next wants one of them,
+* needs a victim or runs the flusher finds its read
+* done.  At most a quarter of the pool is given to
+* it.  Called with pool_lock held.
+*/
+static void prefetch_frames(int table_id, const pagenum_t* pages, int n)
+{
+	pagenum_t pagenums[FLUSH_BATCH];
+	page_t* frames_read[FLUSH_BATCH];
+	uring_io_t* reads[FLUSH_BATCH];
+	buffer_t* buf;
+	int i, m = 0;
+
+	reap_reads(table_id);
+	for ( i = 0; i < n && m < FLUSH_BATCH && m < buf_num / 4; i++ )
+	{
+		if ( hash_find(table_id, pages[i]) != NULL )
+			continue;
+		// Only a hint: nothing is waited for.
+		buf = find_unpinned();
+		if ( buf == NULL || !claim_frame(buf) )
+			break;
+		if ( buf->is_valid )
+		{
+			hash_remove(buf);
+			__atomic_store_n(&buf->is_valid, false, __ATOMIC_RELAXED);
+		}
+		assign_frame(buf, table_id, pages[i]);
+		buf->is_reading = true;
+		__atomic_store_n(&buf->read.done, 0, __ATOMIC_RELAXED);
+		pagenums[m] = pages[i];
+		frames_read[m] = buf->frame;
+		reads[m++] = &buf->read;
+	}
+	if ( m == 0 )
+		return;
+	pthread_mutex_unlock(&pool_lock);
+	file_read_pages(table_id, pagenums, frames_read, reads, m);
+	pthread_mutex_lock(&pool_lock);
+}
+
+/* Asks the disk layer to start reading the given
+* pages in the background.  Pages already in the
+* pool are skipped and runs of consecutive page
+* numbers are requested together.  A direct table
+* reads them into the pool instead.
+*/
+void buf_prefetch(int table_id, const pagenum_t* pages, int n)
+{
+	int i = 0, j;
+	if ( tables[table_id].backend == BACKEND_DIRECT )
+	{
+		pthread_mutex_lock(&pool_lock);
+		prefetch_frames(table_id, pages, n);
+		pthread_mutex_unlock(&pool_lock);
+		return;
+	}
+	// Only a hint, so the hash table is looked at without pool_lock.
+	while ( i < n )
+	{
+		if ( hash_find(table_id, pages[i]) != NULL )
+		{
+			i++;
+			continue;
+		}
+		for ( j = i + 1; j < n && pages[j] == pages[j - 1] + 1 &&
+			 hash_find(table_id, pages[j]) == NULL; j++ )
+			;
+		file_prefetch(table_id, pages[i], j - i);
+		i = j;
+	}
+}
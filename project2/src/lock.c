@@ -0,0 +1,246 @@
+#include "lock.h"
+#include "page.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* A lock held or requested by a transaction on
+* one record.  Requests on a record are queued in
+* arrival order in its lock_entry_t, and a request
+* is granted once nothing ahead of it in the queue
+* conflicts with it.
+*/
+typedef struct lock_t
+{
+	int mode;
+	bool granted;
+	trx_t* trx;
+	struct lock_entry_t* entry;
+	struct lock_t* next;
+	struct lock_t* trx_next;
+} lock_t;
+
+typedef struct lock_entry_t
+{
+	int table_id;
+	int64_t key;
+	lock_t* head;
+	lock_t* tail;
+	struct lock_entry_t* hash_next;
+} lock_entry_t;
+
+static lock_entry_t* lock_table[LOCK_HASH_SIZE];
+
+/* lock_table_lock guards the lock table, every
+* lock_t and the wait_lock of every transaction.
+* It is only held for the bookkeeping; a waiting
+* transaction sleeps on its own condition.
+*/
+static pthread_mutex_t lock_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Stamp of the latest deadlock search.
+static int search_stamp = 0;
+
+
+static int lock_hash(int table_id, int64_t key)
+{
+	return (int)(((uint64_t)key * MAX_TABLES + table_id) % LOCK_HASH_SIZE);
+}
+
+/* Returns the queue of a record, creating it if
+* create is set, or NULL.
+*/
+static lock_entry_t* find_entry(int table_id, int64_t key, bool create)
+{
+	int h = lock_hash(table_id, key);
+	lock_entry_t* c = lock_table[h];
+	while ( c != NULL && (c->key != key || c->table_id != table_id) )
+	{
+		c = c->hash_next;
+	}
+	if ( c == NULL && create )
+	{
+		c = (lock_entry_t*)calloc(1, sizeof(lock_entry_t));
+		if ( c == NULL )
+		{
+			perror("Lock table.");
+			exit(EXIT_FAILURE);
+		}
+		c->table_id = table_id;
+		c->key = key;
+		c->hash_next = lock_table[h];
+		lock_table[h] = c;
+	}
+	return c;
+}
+
+static void remove_entry(lock_entry_t* entry)
+{
+	lock_entry_t** c = &lock_table[lock_hash(entry->table_id, entry->key)];
+	while ( *c != entry )
+	{
+		c = &(*c)->hash_next;
+	}
+	*c = entry->hash_next;
+	free(entry);
+}
+
+static bool conflicts(lock_t* a, lock_t* b)
+{
+	return a->trx != b->trx && (a->mode == LOCK_EXCLUSIVE || b->mode == LOCK_EXCLUSIVE);
+}
+
+static bool grantable(lock_t* lock)
+{
+	lock_t* c;
+	for ( c = lock->entry->head; c != lock; c = c->next )
+	{
+		if ( conflicts(c, lock) )
+			return false;
+	}
+	return true;
+}
+
+/* Grants every waiting request on a record that
+* no longer conflicts with anything ahead of it.
+*/
+static void grant_waiters(lock_entry_t* entry)
+{
+	lock_t* c;
+	for ( c = entry->head; c != NULL; c = c->next )
+	{
+		if ( !c->granted && grantable(c) )
+		{
+			c->granted = true;
+			c->trx->wait_lock = NULL;
+			pthread_cond_signal(&c->trx->cond);
+		}
+	}
+}
+
+static void unlink_lock(lock_t* lock)
+{
+	lock_entry_t* entry = lock->entry;
+	lock_t** c = &entry->head;
+	lock_t* prev = NULL;
+	while ( *c != lock )
+	{
+		prev = *c;
+		c = &(*c)->next;
+	}
+	*c = lock->next;
+	if ( entry->tail == lock )
+		entry->tail = prev;
+
+	if ( entry->head == NULL )
+		remove_entry(entry);
+	else
+		grant_waiters(entry);
+}
+
+/* Returns true if waiter is, through the chain of
+* requests blocking each other, waiting for target.
+* The waits-for graph is walked depth first; a
+* transaction already visited by this search
+* (visited == stamp) leads nowhere new.
+*/
+static bool waits_for(trx_t* waiter, trx_t* target, int stamp)
+{
+	lock_t* c;
+	lock_t* wait_lock = waiter->wait_lock;
+	waiter->visited = stamp;
+	if ( wait_lock == NULL )
+		return false;
+	for ( c = wait_lock->entry->head; c != wait_lock; c = c->next )
+	{
+		if ( !conflicts(c, wait_lock) )
+			continue;
+		if ( c->trx == target )
+			return true;
+		if ( c->trx->visited != stamp && waits_for(c->trx, target, stamp) )
+			return true;
+	}
+	return false;
+}
+
+/* Locks a record for a transaction, waiting for
+* conflicting holders to finish.  A lock the
+* transaction already holds in the same or a
+* stronger mode is reused; a shared lock is upgraded
+* by queueing an exclusive request behind it.
+* A request that would close a cycle in the
+* waits-for graph is not queued: LOCK_DEADLOCK is
+* returned, and the caller must abort the
+* transaction.  The transaction closing a cycle is
+* always the one to check, so every deadlock is
+* found by the request that creates it.
+*/
+int lock_acquire(trx_t* trx, int table_id, int64_t key, int mode)
+{
+	lock_entry_t* entry;
+	lock_t* lock, * c;
+
+	pthread_mutex_lock(&lock_table_lock);
+	entry = find_entry(table_id, key, true);
+	for ( c = entry->head; c != NULL; c = c->next )
+	{
+		if ( c->trx == trx && c->granted && c->mode >= mode )
+		{
+			pthread_mutex_unlock(&lock_table_lock);
+			return LOCK_GRANTED;
+		}
+	}
+
+	lock = (lock_t*)calloc(1, sizeof(lock_t));
+	if ( lock == NULL )
+	{
+		perror("Lock table.");
+		exit(EXIT_FAILURE);
+	}
+	lock->mode = mode;
+	lock->trx = trx;
+	lock->entry = entry;
+	if ( entry->tail != NULL )
+		entry->tail->next = lock;
+	else
+		entry->head = lock;
+	entry->tail = lock;
+
+	lock->granted = grantable(lock);
+	if ( !lock->granted )
+	{
+		trx->wait_lock = lock;
+		if ( waits_for(trx, trx, ++search_stamp) )
+		{
+			trx->wait_lock = NULL;
+			unlink_lock(lock);
+			free(lock);
+			pthread_mutex_unlock(&lock_table_lock);
+			return LOCK_DEADLOCK;
+		}
+		while ( !lock->granted )
+		{
+			pthread_cond_wait(&trx->cond, &lock_table_lock);
+		}
+	}
+	lock->trx_next = trx->locks;
+	trx->locks = lock;
+	pthread_mutex_unlock(&lock_table_lock);
+	return LOCK_GRANTED;
+}
+
+/* Releases every lock of a transaction and wakes
+* the requests that can now go ahead.
+*/
+void lock_release_all(trx_t* trx)
+{
+	lock_t* lock;
+	pthread_mutex_lock(&lock_table_lock);
+	while ( trx->locks != NULL )
+	{
+		lock = trx->locks;
+		trx->locks = lock->trx_next;
+		unlink_lock(lock);
+		free(lock);
+	}
+	pthread_mutex_unlock(&lock_table_lock);
+}
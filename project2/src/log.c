@@ -0,0 +1,671 @@
+#define _GNU_SOURCE
+#include "log.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// "bptlog" followed by a format version.
+#define LOG_MAGIC 0x01676f6c747062ULL
+
+/* Log state of one open table.
+* Each table has its own log file next to it and
+* its own lsn sequence.  file_lsn is where the
+* buffered tail starts; synced_lsn is the end of
+* the last commit, also read without the lock (see
+* log_synced_lsn).  active lists the transactions
+* with records in this log that have not ended, and
+* reclaimed the prefix of the file already given
+* back by checkpoints.
+* lock guards all of it: transactions append their
+* own records while the buffer pool commits.
+*/
+typedef struct
+{
+	int fd;
+	char* buffer;
+	int buffer_len;
+	uint64_t file_lsn;
+	uint64_t synced_lsn;
+	off_t reclaimed;
+	log_master_t master;
+	log_trx_t* active;
+	int num_active;
+	int active_capacity;
+	pthread_mutex_t lock;
+} log_t;
+
+static log_t logs[MAX_TABLES + 1];
+
+
+static off_t lsn_offset(log_t* log, uint64_t lsn)
+{
+	return (off_t)(lsn - log->master.base_lsn) + LOG_MASTER_SIZE;
+}
+
+static uint64_t next_lsn(log_t* log)
+{
+	return log->file_lsn + log->buffer_len;
+}
+
+static uint64_t checksum(uint64_t h, const void* data, size_t len)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	size_t i;
+	for ( i = 0; i < len; i++ )
+	{
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static uint64_t record_checksum(const log_record_t* rec, const void* payload)
+{
+	log_record_t tmp = *rec;
+	uint64_t h = 14695981039346656037ULL;
+	tmp.checksum = 0;
+	h = checksum(h, &tmp, sizeof(tmp));
+	if ( payload != NULL )
+	{
+		h = checksum(h, payload, rec->size - sizeof(log_record_t));
+	}
+	return h;
+}
+
+/* Writes the buffered log tail to the log file.
+* Does not sync; see log_commit.
+*/
+static void write_buffer(log_t* log)
+{
+	int done = 0;
+	off_t offset = lsn_offset(log, log->file_lsn);
+	while ( done < log->buffer_len )
+	{
+		ssize_t n = pwrite(log->fd, log->buffer + done, log->buffer_len - done, offset + done);
+		if ( n < 0 )
+		{
+			perror("Log write.");
+			exit(EXIT_FAILURE);
+		}
+		done += n;
+	}
+	log->file_lsn += log->buffer_len;
+	log->buffer_len = 0;
+}
+
+static void sync_log(log_t* log)
+{
+	if ( fdatasync(log->fd) )
+	{
+		perror("Log sync.");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Appends a record and returns its lsn.
+*/
+static uint64_t append(log_t* log, log_record_t* rec, const void* payload)
+{
+	int payload_size = rec->size - sizeof(log_record_t);
+
+	if ( rec->size > LOG_BUFFER_SIZE )
+	{
+		fprintf(stderr, "Log record of %u bytes does not fit the log buffer.\n", rec->size);
+		exit(EXIT_FAILURE);
+	}
+	if ( log->buffer_len + (int)rec->size > LOG_BUFFER_SIZE )
+	{
+		write_buffer(log);
+	}
+	rec->lsn = next_lsn(log);
+	rec->checksum = record_checksum(rec, payload);
+	memcpy(log->buffer + log->buffer_len, rec, sizeof(log_record_t));
+	if ( payload_size > 0 )
+	{
+		memcpy(log->buffer + log->buffer_len + sizeof(log_record_t), payload, payload_size);
+	}
+	log->buffer_len += rec->size;
+	return rec->lsn;
+}
+
+static void write_master(log_t* log)
+{
+	if ( pwrite(log->fd, &log->master, sizeof(log_master_t), 0) != sizeof(log_master_t) )
+	{
+		perror("Log master.");
+		exit(EXIT_FAILURE);
+	}
+	sync_log(log);
+}
+
+/* Reads the record at lsn into rec and its payload,
+* which may take up to max bytes, from the file or,
+* if it is not written yet, from the buffer.
+* Returns 0 if a complete, intact record is there.
+*/
+static int read_record(log_t* log, uint64_t lsn, log_record_t* rec, void* payload, size_t max)
+{
+	size_t payload_size;
+
+	if ( lsn < log->master.base_lsn )
+		return -1;
+	if ( lsn >= log->file_lsn )
+	{
+		if ( lsn + sizeof(log_record_t) > next_lsn(log) )
+			return -1;
+		memcpy(rec, log->buffer + (lsn - log->file_lsn), sizeof(log_record_t));
+	}
+	else if ( pread(log->fd, rec, sizeof(log_record_t), lsn_offset(log, lsn)) != sizeof(log_record_t) )
+		return -1;
+
+	if ( rec->lsn != lsn || rec->size < sizeof(log_record_t) ||
+		rec->type < LOG_PAGE || rec->type > LOG_CHECKPOINT )
+		return -1;
+	payload_size = rec->size - sizeof(log_record_t);
+	if ( payload_size > max )
+		return -1;
+	if ( payload_size > 0 )
+	{
+		if ( lsn >= log->file_lsn )
+		{
+			if ( lsn + rec->size > next_lsn(log) )
+				return -1;
+			memcpy(payload, log->buffer + (lsn - log->file_lsn) + sizeof(log_record_t), payload_size);
+		}
+		else if ( pread(log->fd, payload, payload_size, lsn_offset(log, lsn) + sizeof(log_record_t)) !=
+				  (ssize_t)payload_size )
+			return -1;
+	}
+	return rec->checksum == record_checksum(rec, payload_size > 0 ? payload : NULL) ? 0 : -1;
+}
+
+/* Returns the entry of a transaction in the
+* active list, adding it if create is set, or NULL.
+*/
+static log_trx_t* find_active(log_t* log, int trx_id, bool create)
+{
+	int i;
+	for ( i = 0; i < log->num_active; i++ )
+	{
+		if ( log->active[i].trx_id == trx_id )
+			return &log->active[i];
+	}
+	if ( !create )
+		return NULL;
+	if ( log->num_active == log->active_capacity )
+	{
+		log->active_capacity = log->active_capacity ? log->active_capacity * 2 : 16;
+		log->active = (log_trx_t*)realloc(log->active, sizeof(log_trx_t) * log->active_capacity);
+		if ( log->active == NULL )
+		{
+			perror("Log transaction table.");
+			exit(EXIT_FAILURE);
+		}
+	}
+	log->active[log->num_active].trx_id = trx_id;
+	log->active[log->num_active].first_lsn = 0;
+	log->active[log->num_active].last_lsn = 0;
+	return &log->active[log->num_active++];
+}
+
+static void remove_active(log_t* log, log_trx_t* trx)
+{
+	*trx = log->active[--log->num_active];
+}
+
+/* Appends a transaction record, chained to the
+* transaction's previous one in this log.
+*/
+static uint64_t append_trx(log_t* log, log_record_t* rec, const void* payload)
+{
+	log_trx_t* trx = find_active(log, rec->trx_id, true);
+	uint64_t lsn;
+	rec->prev_lsn = trx->last_lsn;
+	lsn = append(log, rec, payload);
+	if ( trx->first_lsn == 0 )
+		trx->first_lsn = lsn;
+	trx->last_lsn = lsn;
+	return lsn;
+}
+
+/* Empties the log, which must hold nothing still
+* needed.  The lsn sequence carries on where it
+* was, so page lsns already in the table stay
+* older than every record to come.
+*/
+static void reset_log(log_t* log)
+{
+	log->master.base_lsn = next_lsn(log);
+	log->master.checkpoint_lsn = 0;
+	log->file_lsn = log->master.base_lsn;
+	__atomic_store_n(&log->synced_lsn, log->file_lsn, __ATOMIC_RELEASE);
+	log->buffer_len = 0;
+	log->reclaimed = LOG_MASTER_SIZE;
+	if ( ftruncate(log->fd, LOG_MASTER_SIZE) )
+	{
+		perror("Log truncate.");
+		exit(EXIT_FAILURE);
+	}
+	write_master(log);
+}
+
+/* Restart recovery, run when a table is opened.
+* Analysis and redo make one pass over the log from
+* the redo point of the last checkpoint, which is
+* all a restart has to read:
+* - every page image of a committed group whose
+*   page in the table is older (by page lsn) is
+*   written back;
+* - the transactions that have records but never
+*   ended are collected in active, starting from
+*   the list the checkpoint saved.
+* Records after the last intact commit record belong
+* to a group that never committed and are cut off.
+* The transactions left in active lost the crash;
+* trx_recover rolls them back once the table is
+* usable.
+*/
+static void recover(int table_id)
+{
+	log_t* log = &logs[table_id];
+	log_record_t rec;
+	log_checkpoint_t* checkpoint;
+	page_t* page;
+	char* payload;
+	uint64_t lsn, start, committed_end;
+	uint64_t checkpoint_lsn = log->master.checkpoint_lsn;
+	bool redone = false;
+	int i;
+
+	payload = (char*)malloc(LOG_BUFFER_SIZE);
+	if ( posix_memalign((void**)&page, 4096, sizeof(page_t)) || payload == NULL )
+	{
+		perror("Log recovery.");
+		exit(EXIT_FAILURE);
+	}
+
+	// Nothing is buffered: every read goes to the file.
+	log->file_lsn = UINT64_MAX;
+	start = log->master.base_lsn;
+	if ( checkpoint_lsn != 0 && !read_record(log, checkpoint_lsn, &rec, payload, LOG_BUFFER_SIZE) &&
+		rec.type == LOG_CHECKPOINT )
+	{
+		start = ((log_checkpoint_t*)payload)->redo_lsn;
+	}
+	else
+	{
+		checkpoint_lsn = 0;
+	}
+
+	committed_end = start;
+	for ( lsn = start; !read_record(log, lsn, &rec, payload, LOG_BUFFER_SIZE); lsn += rec.size )
+	{
+		if ( rec.type == LOG_COMMIT )
+			committed_end = lsn + rec.size;
+	}
+
+	for ( lsn = start; lsn < committed_end; lsn += rec.size )
+	{
+		read_record(log, lsn, &rec, payload, LOG_BUFFER_SIZE);
+		switch ( rec.type )
+		{
+		case LOG_PAGE:
+			memset(page, 0, sizeof(page_t));
+			file_read_page(table_id, rec.pagenum, page);
+			if ( page->lsn < rec.lsn )
+			{
+				file_write_page(table_id, rec.pagenum, (page_t*)payload);
+				redone = true;
+			}
+			break;
+		case LOG_UPDATE:
+		case LOG_CLR:
+			if ( lsn > checkpoint_lsn )
+			{
+				log_trx_t* trx = find_active(log, rec.trx_id, true);
+				if ( trx->first_lsn == 0 )
+					trx->first_lsn = lsn;
+				trx->last_lsn = lsn;
+			}
+			break;
+		case LOG_END:
+			if ( lsn > checkpoint_lsn && find_active(log, rec.trx_id, false) != NULL )
+				remove_active(log, find_active(log, rec.trx_id, false));
+			break;
+		case LOG_CHECKPOINT:
+			if ( lsn == checkpoint_lsn )
+			{
+				checkpoint = (log_checkpoint_t*)payload;
+				log->num_active = 0;
+				for ( i = 0; i < checkpoint->num_active; i++ )
+					*find_active(log, 0, true) = ((log_trx_t*)(checkpoint + 1))[i];
+			}
+			break;
+		}
+	}
+	free(page);
+	free(payload);
+
+	if ( redone )
+	{
+		file_sync(table_id);
+	}
+	log->file_lsn = committed_end;
+	__atomic_store_n(&log->synced_lsn, committed_end, __ATOMIC_RELEASE);
+	if ( log->num_active == 0 )
+	{
+		reset_log(log);
+	}
+	else if ( ftruncate(log->fd, lsn_offset(log, committed_end)) )
+	{
+		perror("Log truncate.");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Opens (creating if needed) the log belonging to
+* the table at table_path and replays it.
+* Must be called after the table file is open.
+*/
+int log_open(int table_id, const char* table_path)
+{
+	log_t* log = &logs[table_id];
+	char path[512];
+
+	snprintf(path, sizeof(path), "%s.log", table_path);
+	log->fd = open(path, O_CREAT | O_RDWR, 0644);
+	if ( log->fd < 0 )
+	{
+		return -1;
+	}
+	log->buffer = (char*)malloc(LOG_BUFFER_SIZE);
+	if ( log->buffer == NULL )
+	{
+		close(log->fd);
+		log->fd = -1;
+		return -1;
+	}
+	log->buffer_len = 0;
+	log->num_active = 0;
+	log->reclaimed = LOG_MASTER_SIZE;
+	pthread_mutex_init(&log->lock, NULL);
+
+	if ( pread(log->fd, &log->master, sizeof(log_master_t), 0) != sizeof(log_master_t) ||
+		log->master.magic != LOG_MAGIC )
+	{
+		// A new log.
+		log->master.magic = LOG_MAGIC;
+		log->master.base_lsn = 1;
+		log->master.checkpoint_lsn = 0;
+		log->file_lsn = 1;
+		reset_log(log);
+	}
+	recover(table_id);
+	return 0;
+}
+
+void log_close(int table_id)
+{
+	log_t* log = &logs[table_id];
+	if ( log->buffer == NULL )
+	{
+		return;
+	}
+	close(log->fd);
+	log->fd = -1;
+	free(log->buffer);
+	log->buffer = NULL;
+	free(log->active);
+	log->active = NULL;
+	log->num_active = log->active_capacity = 0;
+	pthread_mutex_destroy(&log->lock);
+}
+
+/* Appends the after-image of a page, stamping the
+* page with the record's lsn first so the image
+* (and the page once written back) carries it.
+*/
+uint64_t log_append_page(int table_id, pagenum_t pagenum, page_t* image)
+{
+	log_t* log = &logs[table_id];
+	log_record_t rec;
+	uint64_t lsn;
+	memset(&rec, 0, sizeof(rec));
+	rec.type = LOG_PAGE;
+	rec.size = sizeof(log_record_t) + sizeof(page_t);
+	rec.pagenum = pagenum;
+	pthread_mutex_lock(&log->lock);
+	image->lsn = next_lsn(log);
+	lsn = append(log, &rec, image);
+	pthread_mutex_unlock(&log->lock);
+	return lsn;
+}
+
+/* Appends the undo information of a change a
+* transaction is about to make to record key.
+*/
+uint64_t log_append_update(int table_id, int trx_id, int op, int64_t key, const char* old_value)
+{
+	log_t* log = &logs[table_id];
+	log_record_t rec;
+	uint64_t lsn;
+	memset(&rec, 0, sizeof(rec));
+	if ( old_value == NULL )
+		old_value = "";
+	rec.type = LOG_UPDATE;
+	rec.size = sizeof(log_record_t) + strlen(old_value) + 1;
+	rec.trx_id = trx_id;
+	rec.op = op;
+	rec.key = key;
+	pthread_mutex_lock(&log->lock);
+	lsn = append_trx(log, &rec, old_value);
+	pthread_mutex_unlock(&log->lock);
+	return lsn;
+}
+
+/* Appends a compensation record: the transaction's
+* changes from undo_next_lsn on are undone.
+*/
+uint64_t log_append_clr(int table_id, int trx_id, uint64_t undo_next_lsn)
+{
+	log_t* log = &logs[table_id];
+	log_record_t rec;
+	uint64_t lsn;
+	memset(&rec, 0, sizeof(rec));
+	rec.type = LOG_CLR;
+	rec.size = sizeof(log_record_t);
+	rec.trx_id = trx_id;
+	rec.undo_next_lsn = undo_next_lsn;
+	pthread_mutex_lock(&log->lock);
+	lsn = append_trx(log, &rec, NULL);
+	pthread_mutex_unlock(&log->lock);
+	return lsn;
+}
+
+/* Ends a transaction in this log, if it has
+* records here.
+*/
+void log_append_end(int table_id, int trx_id)
+{
+	log_t* log = &logs[table_id];
+	log_record_t rec;
+	log_trx_t* trx;
+	pthread_mutex_lock(&log->lock);
+	trx = find_active(log, trx_id, false);
+	if ( trx != NULL )
+	{
+		memset(&rec, 0, sizeof(rec));
+		rec.type = LOG_END;
+		rec.size = sizeof(log_record_t);
+		rec.trx_id = trx_id;
+		rec.prev_lsn = trx->last_lsn;
+		append(log, &rec, NULL);
+		remove_active(log, trx);
+	}
+	pthread_mutex_unlock(&log->lock);
+}
+
+/* Returns one transaction that has records in this
+* log and has not ended, with its last record.
+*/
+bool log_first_active(int table_id, int* trx_id, uint64_t* last_lsn)
+{
+	log_t* log = &logs[table_id];
+	bool found;
+	pthread_mutex_lock(&log->lock);
+	found = log->num_active > 0;
+	if ( found )
+	{
+		*trx_id = log->active[0].trx_id;
+		*last_lsn = log->active[0].last_lsn;
+	}
+	pthread_mutex_unlock(&log->lock);
+	return found;
+}
+
+/* Reads a LOG_UPDATE or LOG_CLR record.  value
+* receives the old value of an update and must have
+* room for MAX_VALUE_SIZE + 1 bytes.
+* Returns 0 on success.
+*/
+int log_read(int table_id, uint64_t lsn, log_record_t* rec, char* value)
+{
+	log_t* log = &logs[table_id];
+	int result;
+	pthread_mutex_lock(&log->lock);
+	result = read_record(log, lsn, rec, value, MAX_VALUE_SIZE + 1);
+	pthread_mutex_unlock(&log->lock);
+	return result;
+}
+
+// Returns true if records were appended since the last commit.
+bool log_pending(int table_id)
+{
+	log_t* log = &logs[table_id];
+	bool pending;
+	pthread_mutex_lock(&log->lock);
+	pending = next_lsn(log) > log->synced_lsn;
+	pthread_mutex_unlock(&log->lock);
+	return pending;
+}
+
+/* Returns the end of the log made durable by the
+* last commit.  A page image with a lower lsn is
+* committed and may be written to the table.
+* Does not wait for a commit in progress.
+*/
+uint64_t log_synced_lsn(int table_id)
+{
+	return __atomic_load_n(&logs[table_id].synced_lsn, __ATOMIC_ACQUIRE);
+}
+
+/* Closes the current group with a commit record and
+* makes the whole group durable with a single sync.
+*/
+void log_commit(int table_id)
+{
+	log_t* log = &logs[table_id];
+	log_record_t rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.type = LOG_COMMIT;
+	rec.size = sizeof(log_record_t);
+	pthread_mutex_lock(&log->lock);
+	append(log, &rec, NULL);
+	write_buffer(log);
+	sync_log(log);
+	__atomic_store_n(&log->synced_lsn, log->file_lsn, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&log->lock);
+}
+
+// Returns the size of the log written since the last checkpoint.
+int64_t log_size(int table_id)
+{
+	log_t* log = &logs[table_id];
+	int64_t size;
+	pthread_mutex_lock(&log->lock);
+	size = next_lsn(log) - (log->master.checkpoint_lsn ? log->master.checkpoint_lsn : log->master.base_lsn);
+	pthread_mutex_unlock(&log->lock);
+	return size;
+}
+
+uint64_t log_checkpoint_lsn(int table_id)
+{
+	log_t* log = &logs[table_id];
+	uint64_t lsn;
+	pthread_mutex_lock(&log->lock);
+	lsn = log->master.checkpoint_lsn;
+	pthread_mutex_unlock(&log->lock);
+	return lsn;
+}
+
+/* Takes a checkpoint.  The caller has committed the
+* log and written back every page changed before
+* redo_lsn, or every page if redo_lsn is 0.
+* The checkpoint record saves redo_lsn and the
+* active transactions, and the master record is
+* pointed at it, so recovery reads nothing older.
+* The part of the log before both redo_lsn and the
+* first record of every active transaction is
+* given back to the file system; with neither left,
+* the log is simply emptied.
+*/
+void log_checkpoint(int table_id, uint64_t redo_lsn)
+{
+	log_t* log = &logs[table_id];
+	log_record_t rec;
+	log_checkpoint_t* checkpoint;
+	uint64_t lsn, keep;
+	off_t hole;
+	int i;
+
+	pthread_mutex_lock(&log->lock);
+	if ( redo_lsn == 0 && log->num_active == 0 )
+	{
+		reset_log(log);
+		pthread_mutex_unlock(&log->lock);
+		return;
+	}
+
+	checkpoint = (log_checkpoint_t*)malloc(sizeof(log_checkpoint_t) + sizeof(log_trx_t) * log->num_active);
+	if ( checkpoint == NULL )
+	{
+		perror("Log checkpoint.");
+		exit(EXIT_FAILURE);
+	}
+	checkpoint->redo_lsn = redo_lsn != 0 ? redo_lsn : next_lsn(log);
+	checkpoint->num_active = log->num_active;
+	memcpy(checkpoint + 1, log->active, sizeof(log_trx_t) * log->num_active);
+	memset(&rec, 0, sizeof(rec));
+	rec.type = LOG_CHECKPOINT;
+	rec.size = sizeof(log_record_t) + sizeof(log_checkpoint_t) + sizeof(log_trx_t) * log->num_active;
+	lsn = append(log, &rec, checkpoint);
+	keep = checkpoint->redo_lsn;
+	free(checkpoint);
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = LOG_COMMIT;
+	rec.size = sizeof(log_record_t);
+	append(log, &rec, NULL);
+	write_buffer(log);
+	sync_log(log);
+	__atomic_store_n(&log->synced_lsn, log->file_lsn, __ATOMIC_RELEASE);
+	log->master.checkpoint_lsn = lsn;
+	write_master(log);
+
+	for ( i = 0; i < log->num_active; i++ )
+	{
+		if ( log->active[i].first_lsn < keep )
+			keep = log->active[i].first_lsn;
+	}
+	hole = lsn_offset(log, keep) & ~(off_t)4095;
+	if ( hole > log->reclaimed )
+	{
+		// Only space; a file system without holes keeps the bytes.
+		fallocate(log->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, log->reclaimed, hole - log->reclaimed);
+		log->reclaimed = hole;
+	}
+	pthread_mutex_unlock(&log->lock);
+}
@@ -1,9 +1,15 @@
 #include "bpt.h"
 #include "page.h"
+#include "buffer.h"
+#include "trx.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+
+// Turns a macro's value into a string, for scanf widths.
+#define STR(x) #x
+#define XSTR(x) STR(x)
 // MAIN
 /*
 int main( int argc, char ** argv ) {
@@ -104,9 +110,70 @@ return EXIT_SUCCESS;
 }
 */
 
-int main()
+/* Reads the "key value" lines of a file into
+* arrays allocated here, each value strdup'ed.
+* Returns the number of lines, or -1 if the file
+* cannot be opened.
+*/
+static int read_pairs(const char * pathname, int64_t ** keys_out, char *** values_out)
+{
+	int n = 0, capacity = 1024;
+	int64_t * keys;
+	char ** values;
+	char value[MAX_VALUE_SIZE + 1];
+	int64_t key;
+	FILE * fp;
+
+	fp = fopen(pathname, "r");
+	if ( fp == NULL )
+	{
+		return -1;
+	}
+	keys = (int64_t *)malloc(sizeof(int64_t) * capacity);
+	values = (char **)malloc(sizeof(char *) * capacity);
+	while ( fscanf(fp, "%"PRId64 " %" XSTR(MAX_VALUE_SIZE) "s", &key, value) == 2 )
+	{
+		if ( n == capacity )
+		{
+			capacity *= 2;
+			keys = (int64_t *)realloc(keys, sizeof(int64_t) * capacity);
+			values = (char **)realloc(values, sizeof(char *) * capacity);
+		}
+		keys[n] = key;
+		values[n] = strdup(value);
+		n++;
+	}
+	fclose(fp);
+	*keys_out = keys;
+	*values_out = values;
+	return n;
+}
+
+int main(int argc, char ** argv)
 {
 	char cmd[20];
+	int table_id = -1;
+	/* Transaction the commands below run in,
+	* 0 outside begin ... commit / abort.
+	*/
+	int trx_id = 0;
+	/* The optional second argument, "mmap" or
+	* "direct", picks the backend tables are opened
+	* with.
+	*/
+	int backend = argc < 3 ? BACKEND_PREAD
+				  : !strcmp(argv[2], "mmap") ? BACKEND_MMAP
+				  : !strcmp(argv[2], "direct") ? BACKEND_DIRECT : BACKEND_PREAD;
+
+	/* The optional argument sets the number
+	* of buffer pool frames.
+	*/
+	if ( init_db(argc > 1 ? atoi(argv[1]) : DEFAULT_BUF_NUM) )
+	{
+		perror("Buffer pool creation.");
+		exit(EXIT_FAILURE);
+	}
+
 	while ( true )
 	{
 		scanf("%s", cmd);
@@ -115,14 +182,26 @@ int main()
 		{
 			char pathname[50];
 			scanf("%s", pathname);
-			open_table(pathname);
+			/* Earlier tables stay open; commands
+			* below act on the one opened last.
+			*/
+			table_id = open_table_backend(pathname, backend);
+			if ( table_id < 0 )
+			{
+				printf("OPEN %s : FAIL\n", pathname);
+			}
+		}
+		else if ( !strcmp(cmd, "close") )
+		{
+			close_table(table_id);
+			table_id = -1;
 		}
 		else if ( !strcmp(cmd, "insert") )
 		{
 			int64_t key;
-			char value[120];
-			scanf("%"PRId64 "%s", &key, value);
-			if ( !db_insert(key, value) )
+			char value[MAX_VALUE_SIZE + 1];
+			scanf("%"PRId64 " %" XSTR(MAX_VALUE_SIZE) "s", &key, value);
+			if ( !db_insert(table_id, key, value, trx_id) )
 			{
 				printf("INSERT %10"PRId64" : SUCCESS\n", key);
 			}
@@ -131,12 +210,92 @@ int main()
 				printf("INSERT %10"PRId64" : FAIL\n", key);
 			}
 		}
+		else if ( !strcmp(cmd, "update") )
+		{
+			int64_t key;
+			char value[MAX_VALUE_SIZE + 1];
+			scanf("%"PRId64 " %" XSTR(MAX_VALUE_SIZE) "s", &key, value);
+			if ( !db_update(table_id, key, value, trx_id) )
+			{
+				printf("UPDATE %10"PRId64" : SUCCESS\n", key);
+			}
+			else
+			{
+				printf("UPDATE %10"PRId64" : FAIL\n", key);
+			}
+		}
+		else if ( !strcmp(cmd, "load") || !strcmp(cmd, "batch") )
+		{
+			/* load <file>: bulk-loads the "key value"
+			* lines of file into an empty table, or
+			* inserts them as batch does into any other.
+			* batch <file>: inserts them with
+			* db_insert_batch, into any table.
+			*/
+			char pathname[50];
+			int64_t * keys;
+			char ** values;
+			int n, inserted, result;
+
+			scanf("%s", pathname);
+			n = read_pairs(pathname, &keys, &values);
+			if ( n < 0 )
+			{
+				perror("Failure  open input file.");
+				continue;
+			}
+			if ( cmd[0] == 'l' )
+			{
+				result = db_bulk_load(table_id, keys, values, n, DEFAULT_FILL_FACTOR);
+				if ( result < 0 )
+				{
+					printf("LOAD %d : FAIL\n", n);
+				}
+				else if ( result > 0 )
+				{
+					printf("LOAD %d : NOT EMPTY, INSERTED\n", n);
+				}
+				else
+				{
+					printf("LOAD %d : SUCCESS\n", n);
+				}
+			}
+			else
+			{
+				inserted = db_insert_batch(table_id, keys, values, n, trx_id);
+				if ( inserted < 0 )
+				{
+					printf("BATCH %d : FAIL\n", n);
+				}
+				else
+				{
+					printf("BATCH %d : %d INSERTED\n", n, inserted);
+				}
+			}
+			while ( n > 0 )
+				free(values[--n]);
+			free(keys);
+			free(values);
+		}
+		else if ( !strcmp(cmd, "delete") )
+		{
+			int64_t key;
+			scanf("%"PRId64, &key);
+			if ( !db_delete(table_id, key, trx_id) )
+			{
+				printf("DELETE %10"PRId64" : SUCCESS\n", key);
+			}
+			else
+			{
+				printf("DELETE %10"PRId64" : FAIL\n", key);
+			}
+		}
 		else if ( !strcmp(cmd, "find") )
 		{
 			int64_t key;
-			char value[120];
+			char value[MAX_VALUE_SIZE + 1];
 			scanf("%"PRId64, &key);
-			if ( !db_find(key, value) )
+			if ( !db_find(table_id, key, value, trx_id) )
 			{
 				printf("found : %s\n", value);
 			}
@@ -145,17 +304,105 @@ int main()
 				printf("It doesn't exist!\n");
 			}
 		}
+		else if ( !strcmp(cmd, "findmany") )
+		{
+			/* findmany <n> <key> ...: looks the n keys
+			* up with db_find_many and prints what find
+			* would for each, in the order given.
+			*/
+			int64_t * keys;
+			char ** values;
+			int * results;
+			int i, n;
+
+			scanf("%d", &n);
+			if ( n < 0 )
+				n = 0;
+			keys = (int64_t *)malloc(sizeof(int64_t) * (n + 1));
+			values = (char **)malloc(sizeof(char *) * (n + 1));
+			results = (int *)malloc(sizeof(int) * (n + 1));
+			for ( i = 0; i < n; i++ )
+			{
+				scanf("%"PRId64, &keys[i]);
+				values[i] = (char *)malloc(MAX_VALUE_SIZE + 1);
+			}
+			if ( db_find_many(table_id, keys, values, results, n, trx_id) < 0 )
+			{
+				printf("FINDMANY %d : FAIL\n", n);
+			}
+			else
+			{
+				for ( i = 0; i < n; i++ )
+				{
+					if ( !results[i] )
+					{
+						printf("found : %s\n", values[i]);
+					}
+					else
+					{
+						printf("It doesn't exist!\n");
+					}
+				}
+			}
+			while ( n > 0 )
+				free(values[--n]);
+			free(keys);
+			free(values);
+			free(results);
+		}
+		else if ( !strcmp(cmd, "scan")|| !strcmp(cmd, "rscan") )
+		{
+			int64_t begin, end, key;
+			char value[MAX_VALUE_SIZE + 1];
+			cursor_t cursor;
+			scanf("%"PRId64 "%"PRId64, &begin, &end);
+			db_scan(table_id, &cursor, begin, end, cmd[0] == 'r');
+			while ( !db_scan_next(&cursor, &key, value) )
+			{
+				printf("%"PRId64" : %s\n", key, value);
+			}
+			db_scan_close(&cursor);
+		}
+		else if ( !strcmp(cmd, "begin") )
+		{
+			if ( trx_id == 0 )
+			{
+				trx_id = trx_begin();
+			}
+			printf("BEGIN %d\n", trx_id);
+		}
+		else if ( !strcmp(cmd, "commit") )
+		{
+			/* Outside a transaction, commit just makes
+			* everything done so far durable.
+			*/
+			if ( trx_id != 0 )
+			{
+				trx_commit(trx_id);
+				trx_id = 0;
+			}
+			else
+			{
+				db_commit();
+			}
+		}
+		else if ( !strcmp(cmd, "abort") )
+		{
+			trx_abort(trx_id);
+			trx_id = 0;
+		}
 		else if ( !strcmp(cmd, "quit") )
 		{
+			shutdown_db();
 			return 0;
 		}
 		else if ( !strcmp(cmd, "leaf") )
 		{
-			print_leaves();
+			print_leaves(table_id);
 		}
 		else if ( !strcmp(cmd, "print") )
 		{
-			print_tree();
+			print_tree(table_id);
 		}
 	}
 }
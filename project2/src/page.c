@@ -1,63 +1,408 @@
+#define _GNU_SOURCE
 #include "page.h"
+#include "log.h"
+#include "trx.h"
+#include "uring.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+table_t tables[MAX_TABLES + 1];
+
+// The io_uring of each table opened with BACKEND_DIRECT.
+static uring_t rings[MAX_TABLES + 1];
+
+/* Opens the table at pathname with the pread
+* backend.
+*/
 int open_table(char* pathname)
 {
-	db = open(pathname, O_SYNC | O_CREAT | O_RDWR, 0777);
-	if ( db < 0 )
+	return open_table_backend(pathname, BACKEND_PREAD);
+}
+
+/* Maps the file of a table opened with the mmap
+* backend.  The whole reserve is mapped up front,
+* so the mapping never moves while the file grows
+* under it; only the part the file covers is used.
+* Falls back to the pread backend if mapping fails.
+*/
+static void map_open(table_t* table)
+{
+	struct stat st;
+
+	table->map = NULL;
+	table->map_size = 0;
+	if ( table->backend != BACKEND_MMAP )
+		return;
+	pthread_mutex_init(&table->map_lock, NULL);
+	if ( fstat(table->fd, &st) == 0 )
+	{
+		table->map = mmap(NULL, MMAP_RESERVE, PROT_READ | PROT_WRITE,
+						  MAP_SHARED | MAP_NORESERVE, table->fd, 0);
+	}
+	if ( table->map == NULL || table->map == MAP_FAILED )
+	{
+		pthread_mutex_destroy(&table->map_lock);
+		table->map = NULL;
+		table->backend = BACKEND_PREAD;
+		return;
+	}
+	table->map_size = st.st_size;
+	madvise(table->map, MMAP_RESERVE, MADV_RANDOM);
+}
+
+/* Unmaps a table's file and trims the room grown
+* past its last page.
+*/
+static void map_close(table_t* table)
+{
+	if ( table->backend != BACKEND_MMAP )
+		return;
+	munmap(table->map, MMAP_RESERVE);
+	if ( table->header != NULL )
+		ftruncate(table->fd, (off_t)table->header->num * 4096);
+	pthread_mutex_destroy(&table->map_lock);
+	table->map = NULL;
+}
+
+/* Returns true if the mapping of an mmap table
+* covers bytes up to end, growing the file by at
+* least MMAP_GROW if it has to.  False if end lies
+* past MMAP_RESERVE or the file cannot grow.
+*/
+static bool map_covers(table_t* table, off_t end)
+{
+	off_t size;
+	bool covered;
+
+	if ( table->backend != BACKEND_MMAP || (size_t)end > MMAP_RESERVE )
+		return false;
+	if ( end <= __atomic_load_n(&table->map_size, __ATOMIC_ACQUIRE) )
+		return true;
+	pthread_mutex_lock(&table->map_lock);
+	size = table->map_size;
+	if ( end > size )
+	{
+		size = end > size + MMAP_GROW ? end : size + MMAP_GROW;
+		if ( (size_t)size > MMAP_RESERVE )
+			size = MMAP_RESERVE;
+		if ( ftruncate(table->fd, size) == 0 )
+			__atomic_store_n(&table->map_size, size, __ATOMIC_RELEASE);
+	}
+	covered = end <= table->map_size;
+	pthread_mutex_unlock(&table->map_lock);
+	return covered;
+}
+
+/* True if a transfer can go to an O_DIRECT file as
+* it is: a whole page, at a page boundary, from or
+* to a page-aligned buffer.
+*/
+static bool direct_aligned(const void* buf, size_t size, off_t offset)
+{
+	return size == 4096 && offset % 4096 == 0 && (uintptr_t)buf % 4096 == 0;
+}
+
+/* Reads size bytes at offset of a table's file, from
+* the mapping where the file has them there.  A
+* direct table reads anything that is not a whole
+* aligned page through an aligned copy of its page.
+*/
+static void file_read_at(int table_id, void* dest, size_t size, off_t offset)
+{
+	table_t* table = &tables[table_id];
+	uring_io_t io;
+	char bounce[4096] __attribute__((aligned(4096)));
+
+	if ( table->backend == BACKEND_MMAP
+		 && offset + (off_t)size <= __atomic_load_n(&table->map_size, __ATOMIC_ACQUIRE) )
+		memcpy(dest, table->map + offset, size);
+	else if ( table->backend == BACKEND_DIRECT )
+	{
+		io.buf = direct_aligned(dest, size, offset) ? dest : bounce;
+		io.offset = offset - offset % 4096;
+		if ( io.buf == bounce )
+			memset(bounce, 0, sizeof(bounce));
+		uring_rw(&rings[table_id], table->fd, false, &io, 1);
+		if ( io.buf == bounce )
+			memcpy(dest, bounce + offset % 4096, size);
+	}
+	else
+		pread(table->fd, dest, size, offset);
+}
+
+/* Writes size bytes at offset of a table's file.
+* A direct table writes a part of a page by reading
+* the page, changing it and writing it whole.
+*/
+static void file_write_at(int table_id, const void* src, size_t size, off_t offset)
+{
+	table_t* table = &tables[table_id];
+	uring_io_t io;
+	char bounce[4096] __attribute__((aligned(4096)));
+
+	if ( map_covers(table, offset + (off_t)size) )
+		memcpy(table->map + offset, src, size);
+	else if ( table->backend == BACKEND_DIRECT )
+	{
+		io.offset = offset - offset % 4096;
+		if ( direct_aligned(src, size, offset) )
+			io.buf = (void*)src;
+		else
+		{
+			io.buf = bounce;
+			if ( size != 4096 )
+				file_read_at(table_id, bounce, 4096, io.offset);
+			memcpy(bounce + offset % 4096, src, size);
+		}
+		uring_rw(&rings[table_id], table->fd, true, &io, 1);
+	}
+	else
+		pwrite(table->fd, src, size, offset);
+}
+
+/* Opens the table at pathname with one of the
+* BACKEND_* storage backends and returns its id,
+* or -1 on failure.  Opening a table that is
+* already open returns the existing id, whatever
+* backend it was opened with.
+*/
+int open_table_backend(char* pathname, int backend)
+{
+	int table_id, fd;
+	header_page_t* header;
+
+	for ( table_id = 1; table_id <= MAX_TABLES; table_id++ )
+	{
+		if ( is_open_table(table_id) && !strcmp(tables[table_id].pathname, pathname) )
+		{
+			return table_id;
+		}
+	}
+	for ( table_id = 1; table_id <= MAX_TABLES && is_open_table(table_id); table_id++ )
+		;
+	if ( table_id > MAX_TABLES )
+	{
+		return -1;
+	}
+
+	/* A file system without O_DIRECT still gets the
+	* direct backend's io_uring, through the page
+	* cache.
+	*/
+	fd = open(pathname, O_CREAT | O_RDWR | (backend == BACKEND_DIRECT ? O_DIRECT : 0), 0777);
+	if ( fd < 0 && backend == BACKEND_DIRECT && errno == EINVAL )
+		fd = open(pathname, O_CREAT | O_RDWR, 0777);
+	if ( fd < 0 )
 	{
 		return -1;
 	}
-	header = (header_page_t*)malloc(4096);
+	tables[table_id].fd = fd;
+	tables[table_id].backend = backend;
+	tables[table_id].header = NULL;
+	map_open(&tables[table_id]);
+	if ( backend == BACKEND_DIRECT )
+		uring_init(&rings[table_id], URING_ENTRIES);
+	/* Durability comes from the log rather than O_SYNC:
+	* replay whatever committed work had not reached
+	* the table yet before trusting page 0.
+	*/
+	if ( log_open(table_id, pathname) )
+	{
+		map_close(&tables[table_id]);
+		if ( backend == BACKEND_DIRECT )
+			uring_exit(&rings[table_id]);
+		close(fd);
+		tables[table_id].fd = -1;
+		return -1;
+	}
+	// Aligned, as a direct table writes it as it is.
+	if ( posix_memalign((void**)&header, 4096, 4096) )
+	{
+		perror("Header allocation.");
+		exit(EXIT_FAILURE);
+	}
 	memset(header, 0, 4096);
-	file_read_page(0, (page_t*)header);
+	file_read_page(table_id, 0, (page_t*)header);
 
 	if ( header->num == 0 )
 	{
 		header->free = 0;
 		header->root = 0;
 		header->num = 1;
-		file_write_page(0, (page_t*)header);
+		file_write_page(table_id, 0, (page_t*)header);
 	}
-	return db;
+	tables[table_id].header = header;
+	tables[table_id].pathname = strdup(pathname);
+	pthread_rwlock_init(&tables[table_id].root_latch, NULL);
+	tables[table_id].root_version = 0;
+	tables[table_id].rightmost = 0;
+	/* Only now can the transactions the log found
+	* unfinished be rolled back, through the tree.
+	*/
+	trx_recover(table_id);
+	return table_id;
 }
-pagenum_t file_alloc_page()
+bool is_open_table(int table_id)
 {
-	file_read_page(0, (page_t*)header);
-
-	page_t * page = (page_t*)malloc(sizeof(page_t));
+	/* fd 0 never belongs to a table, so zeroed
+	* (never used) slots count as free.
+	*/
+	return table_id >= 1 && table_id <= MAX_TABLES && tables[table_id].fd > 0;
+}
+void file_close_table(int table_id)
+{
+	log_close(table_id);
+	map_close(&tables[table_id]);
+	if ( tables[table_id].backend == BACKEND_DIRECT )
+		uring_exit(&rings[table_id]);
+	close(tables[table_id].fd);
+	tables[table_id].fd = -1;
+	free(tables[table_id].header);
+	tables[table_id].header = NULL;
+	free(tables[table_id].pathname);
+	tables[table_id].pathname = NULL;
+	pthread_rwlock_destroy(&tables[table_id].root_latch);
+}
+/* Takes a new page from the end of the file.  The
+* in-memory header is the authoritative copy;
+* allocation only updates it.  Page 0 is written
+* at checkpoints and logged with every commit.
+* The free list is the buffer pool's (see
+* buf_alloc_page), so its links are logged.
+*/
+pagenum_t file_alloc_page(int table_id)
+{
+	return tables[table_id].header->num++;
+}
+void file_read_page(int table_id, pagenum_t pagenum, page_t * dest)
+{
+	file_read_at(table_id, dest, 4096, pagenum * 4096); // read from pagenum*4096 in db
+}
+void file_write_page(int table_id, pagenum_t pagenum, const page_t* src)
+{
+	file_write_at(table_id, src, 4096, pagenum * 4096);
+}
+/* Starts reading n pages and returns without
+* waiting for a direct table's device: reads[i] is
+* done once pages[i] is in place (see
+* file_wait_read).  A direct table submits them to
+* its io_uring together, so pages must be
+* page-aligned; the other backends read them one by
+* one, right away.
+*/
+void file_read_pages(int table_id, const pagenum_t* pagenums, page_t** pages, uring_io_t** reads, int n)
+{
+	int i;
 
-	pagenum_t alloc_page = header->free;
-	if ( !alloc_page )
+	if ( tables[table_id].backend != BACKEND_DIRECT )
+	{
+		for ( i = 0; i < n; i++ )
+		{
+			file_read_page(table_id, pagenums[i], pages[i]);
+			__atomic_store_n(&reads[i]->done, 1, __ATOMIC_RELEASE);
+		}
+		return;
+	}
+	for ( i = 0; i < n; i++ )
 	{
-		alloc_page = header->num++;
-		file_write_page(0, (page_t*)header);
-		return alloc_page;
+		reads[i]->buf = pages[i];
+		reads[i]->offset = pagenums[i] * 4096;
 	}
-	file_read_page(alloc_page, page);
-	pagenum_t free_to_be = page->next_free;
+	uring_submit(&rings[table_id], tables[table_id].fd, false, reads, n);
+}
 
-	header->free = free_to_be;
-	file_write_page(0, (page_t*)header);
-	return alloc_page;
+// Returns once a read of file_read_pages is done.
+void file_wait_read(int table_id, uring_io_t* read)
+{
+	if ( tables[table_id].backend == BACKEND_DIRECT )
+		uring_wait(&rings[table_id], read);
 }
-void file_free_page(pagenum_t pagenum)
+
+/* Marks the reads of a table that have finished
+* done, without waiting for the rest.
+*/
+void file_reap_reads(int table_id)
 {
-	file_read_page(0, (page_t*)header);
-	page_t * page = (page_t *)malloc(sizeof(page_t));
-	file_read_page(pagenum, page);
-	page->next_free = header->free;
-	header->free = pagenum;
-	file_write_page(0, (page_t*)header);
-	file_write_page(pagenum, page);
+	if ( tables[table_id].backend == BACKEND_DIRECT )
+		uring_reap(&rings[table_id]);
 }
-void file_read_page(pagenum_t pagenum, page_t * dest)
+
+/* Writes n pages at once and waits for them, a
+* direct table's through its io_uring together.  A
+* pread table writes each run of adjacent page
+* numbers with a single pwritev.
+*/
+void file_write_pages(int table_id, const pagenum_t* pagenums, page_t** pages, int n)
+{
+	uring_io_t ios[URING_ENTRIES];
+	struct iovec iov[URING_ENTRIES];
+	int i, count;
+
+	if ( tables[table_id].backend == BACKEND_PREAD )
+	{
+		while ( n > 0 )
+		{
+			iov[0].iov_base = pages[0];
+			iov[0].iov_len = 4096;
+			for ( count = 1; count < n && count < URING_ENTRIES &&
+				 pagenums[count] == pagenums[count - 1] + 1; count++ )
+			{
+				iov[count].iov_base = pages[count];
+				iov[count].iov_len = 4096;
+			}
+			pwritev(tables[table_id].fd, iov, count, (off_t)pagenums[0] * 4096);
+			pagenums += count;
+			pages += count;
+			n -= count;
+		}
+		return;
+	}
+	if ( tables[table_id].backend != BACKEND_DIRECT )
+	{
+		for ( i = 0; i < n; i++ )
+			file_write_page(table_id, pagenums[i], pages[i]);
+		return;
+	}
+	while ( n > 0 )
+	{
+		count = n < URING_ENTRIES ? n : URING_ENTRIES;
+		for ( i = 0; i < count; i++ )
+		{
+			ios[i].buf = pages[i];
+			ios[i].offset = pagenums[i] * 4096;
+		}
+		uring_rw(&rings[table_id], tables[table_id].fd, true, ios, count);
+		pagenums += count;
+		pages += count;
+		n -= count;
+	}
+}
+
+/* Pages written through the mapping are forced out
+* with msync; fdatasync covers the rest and the
+* file size.
+*/
+void file_sync(int table_id)
 {
-	int flag = pread(db, dest, 4096, pagenum * 4096); // read from pagenum*4096 in db
+	table_t* table = &tables[table_id];
+	if ( table->backend == BACKEND_MMAP )
+		msync(table->map, __atomic_load_n(&table->map_size, __ATOMIC_ACQUIRE), MS_SYNC);
+	fdatasync(table->fd);
 }
-void file_write_page(pagenum_t pagenum, const page_t* src)
+void file_prefetch(int table_id, pagenum_t pagenum, int count)
 {
-	int flag = pwrite(db, src, 4096, pagenum * 4096);
+	table_t* table = &tables[table_id];
+	off_t offset = pagenum * 4096, size = (off_t)count * 4096;
+	if ( table->backend == BACKEND_MMAP
+		 && offset + size <= __atomic_load_n(&table->map_size, __ATOMIC_ACQUIRE) )
+		madvise(table->map + offset, size, MADV_WILLNEED);
+	else
+		posix_fadvise(table->fd, offset, size, POSIX_FADV_WILLNEED);
 }
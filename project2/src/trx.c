@@ -0,0 +1,296 @@
+#include "trx.h"
+#include "lock.h"
+#include "bpt.h"
+#include "buffer.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static trx_t* trx_table[TRX_HASH_SIZE];
+static int next_trx_id = 1;
+
+/* trx_table_lock guards the table of active
+* transactions and next_trx_id.  The transactions
+* themselves belong to the thread running them.
+*/
+static pthread_mutex_t trx_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void trx_init(trx_t* trx, int trx_id)
+{
+	memset(trx, 0, sizeof(trx_t));
+	trx->id = trx_id;
+	pthread_cond_init(&trx->cond, NULL);
+}
+
+static void trx_destroy(trx_t* trx)
+{
+	pthread_cond_destroy(&trx->cond);
+	while ( trx->undo_len > 0 )
+	{
+		free(trx->undo[--trx->undo_len].value);
+	}
+	free(trx->undo);
+}
+
+/* Takes a transaction out of the active table.
+* Returns it, or NULL if trx_id is not active.
+*/
+static trx_t* trx_remove(int trx_id)
+{
+	trx_t** c;
+	trx_t* trx;
+	pthread_mutex_lock(&trx_table_lock);
+	c = &trx_table[trx_id % TRX_HASH_SIZE];
+	while ( *c != NULL && (*c)->id != trx_id )
+	{
+		c = &(*c)->hash_next;
+	}
+	trx = *c;
+	if ( trx != NULL )
+	{
+		*c = trx->hash_next;
+	}
+	pthread_mutex_unlock(&trx_table_lock);
+	return trx;
+}
+
+/* Starts a transaction.
+* Returns its id (> 0), or 0 on failure.
+*/
+int trx_begin(void)
+{
+	trx_t* trx = (trx_t*)malloc(sizeof(trx_t));
+	int h;
+	if ( trx == NULL )
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&trx_table_lock);
+	trx_init(trx, next_trx_id++);
+	h = trx->id % TRX_HASH_SIZE;
+	trx->hash_next = trx_table[h];
+	trx_table[h] = trx;
+	pthread_mutex_unlock(&trx_table_lock);
+	return trx->id;
+}
+
+/* Returns the active transaction trx_id, or NULL.
+*/
+trx_t* trx_get(int trx_id)
+{
+	trx_t* trx;
+	pthread_mutex_lock(&trx_table_lock);
+	trx = trx_table[trx_id % TRX_HASH_SIZE];
+	while ( trx != NULL && trx->id != trx_id )
+	{
+		trx = trx->hash_next;
+	}
+	pthread_mutex_unlock(&trx_table_lock);
+	return trx;
+}
+
+/* Closes a transaction in the log of every open
+* table it has records in.
+*/
+static void end_logs(int trx_id)
+{
+	int table_id;
+	for ( table_id = 1; table_id <= MAX_TABLES; table_id++ )
+	{
+		if ( is_open_table(table_id) )
+		{
+			log_append_end(table_id, trx_id);
+		}
+	}
+}
+
+/* Reverses one change to a record.  Undo is
+* logical and runs whether or not the change itself
+* reached the table before a crash: the key is only
+* deleted if there, and so on.
+*/
+static void undo_change(int table_id, int type, int64_t key, char* value)
+{
+	switch ( type )
+	{
+	case UNDO_INSERT:
+		delete_record(table_id, key, NULL);
+		break;
+	case UNDO_DELETE:
+		insert_record(table_id, key, value);
+		break;
+	case UNDO_UPDATE:
+		update_record(table_id, key, value, NULL);
+		break;
+	}
+}
+
+/* Commits a transaction: its changes are made
+* durable, then its locks are released, so nothing
+* it wrote is seen by others before it is safe.
+* Returns 0, or 1 if trx_id is not active.
+*/
+int trx_commit(int trx_id)
+{
+	trx_t* trx = trx_remove(trx_id);
+	if ( trx == NULL )
+	{
+		return 1;
+	}
+	end_logs(trx_id);
+	buf_commit();
+	lock_release_all(trx);
+	trx_destroy(trx);
+	free(trx);
+	return 0;
+}
+
+/* Aborts a transaction, undoing its changes newest
+* first.  Its exclusive locks are still held, so
+* every record it touched is as it left it.
+* Each undone change is followed by a compensation
+* record pointing at the next change to undo in that
+* table, so a crash during the rollback resumes it
+* instead of starting over.
+* Returns 0, or 1 if trx_id is not active.
+*/
+int trx_abort(int trx_id)
+{
+	trx_t* trx = trx_remove(trx_id);
+	undo_t* undo;
+	uint64_t undo_next;
+	int i;
+	if ( trx == NULL )
+	{
+		return 1;
+	}
+	while ( trx->undo_len > 0 )
+	{
+		undo = &trx->undo[--trx->undo_len];
+		undo_change(undo->table_id, undo->type, undo->key, undo->value);
+		undo_next = 0;
+		for ( i = trx->undo_len - 1; i >= 0 && undo_next == 0; i-- )
+		{
+			if ( trx->undo[i].table_id == undo->table_id )
+				undo_next = trx->undo[i].lsn;
+		}
+		log_append_clr(undo->table_id, trx_id, undo_next);
+		free(undo->value);
+	}
+	end_logs(trx_id);
+	lock_release_all(trx);
+	trx_destroy(trx);
+	free(trx);
+	return 0;
+}
+
+/* Returns the transaction a single operation runs
+* in.  trx_id 0 stands for no transaction: the
+* operation then runs in a transaction of its own,
+* set up in *implicit, that ends with trx_leave.
+* Returns NULL if trx_id is not active.
+*/
+trx_t* trx_enter(int trx_id, trx_t* implicit)
+{
+	if ( trx_id != 0 )
+	{
+		return trx_get(trx_id);
+	}
+	trx_init(implicit, 0);
+	return implicit;
+}
+
+/* Ends an operation started with trx_enter.  An
+* implicit transaction commits here, as one more
+* operation of the current log group; an explicit
+* one carries on.
+*/
+void trx_leave(trx_t* trx)
+{
+	if ( trx->id == 0 )
+	{
+		lock_release_all(trx);
+		trx_destroy(trx);
+	}
+}
+
+/* Records how to reverse a change a transaction is
+* about to make, in memory and in the table's log.
+* value is what the record holds before, for
+* deletes and updates.
+*/
+void trx_add_undo(trx_t* trx, int type, int table_id, int64_t key, const char* value)
+{
+	undo_t* undo;
+	if ( trx->id == 0 )
+	{
+		return;
+	}
+	if ( trx->undo_len == trx->undo_capacity )
+	{
+		trx->undo_capacity = trx->undo_capacity ? trx->undo_capacity * 2 : 16;
+		trx->undo = (undo_t*)realloc(trx->undo, sizeof(undo_t) * trx->undo_capacity);
+		if ( trx->undo == NULL )
+		{
+			perror("Undo log.");
+			exit(EXIT_FAILURE);
+		}
+	}
+	undo = &trx->undo[trx->undo_len++];
+	undo->lsn = log_append_update(table_id, trx->id, type, key, value);
+	undo->type = type;
+	undo->table_id = table_id;
+	undo->key = key;
+	undo->value = NULL;
+	if ( value != NULL )
+	{
+		undo->value = strdup(value);
+		if ( undo->value == NULL )
+		{
+			perror("Undo log.");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/* Rolls back the transactions a crash left open in
+* a table, as found by log recovery, by following
+* each one's records backwards: changes are undone
+* and compensated, and compensation records skip
+* what an interrupted rollback already undid.
+* Called by open_table before the table is used.
+*/
+void trx_recover(int table_id)
+{
+	log_record_t rec;
+	char value[MAX_VALUE_SIZE + 1];
+	uint64_t lsn;
+	int trx_id;
+	bool undone = false;
+
+	while ( log_first_active(table_id, &trx_id, &lsn) )
+	{
+		while ( lsn != 0 && log_read(table_id, lsn, &rec, value) == 0 )
+		{
+			if ( rec.type == LOG_CLR )
+			{
+				lsn = rec.undo_next_lsn;
+				continue;
+			}
+			if ( rec.type == LOG_UPDATE )
+			{
+				undo_change(table_id, rec.op, rec.key, value);
+				log_append_clr(table_id, trx_id, rec.prev_lsn);
+			}
+			lsn = rec.prev_lsn;
+		}
+		log_append_end(table_id, trx_id);
+		undone = true;
+	}
+	if ( undone )
+	{
+		buf_commit();
+	}
+}
@@ -0,0 +1,257 @@
+#include "uring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Sets up an io_uring with room for entries
+* submissions at a time.  Returns 0, or -1 with
+* ring->fd < 0 if io_uring is not available, in
+* which case uring_rw falls back to pread/pwrite.
+*/
+int uring_init(uring_t* ring, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if ( ring->fd < 0 )
+	{
+		ring->fd = -1;
+		return -1;
+	}
+	ring->entries = p.sq_entries;
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ( p.features & IORING_FEAT_SINGLE_MMAP )
+	{
+		if ( ring->cq_ring_size > ring->sq_ring_size )
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+						 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = ring->sq_ring;
+	if ( ring->sq_ring != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP) )
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+							 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+					  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if ( ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED )
+	{
+		close(ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+	ring->sq_head = (unsigned*)((char*)ring->sq_ring + p.sq_off.head);
+	ring->sq_tail = (unsigned*)((char*)ring->sq_ring + p.sq_off.tail);
+	ring->sq_mask = (unsigned*)((char*)ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)((char*)ring->sq_ring + p.sq_off.array);
+	ring->cq_head = (unsigned*)((char*)ring->cq_ring + p.cq_off.head);
+	ring->cq_tail = (unsigned*)((char*)ring->cq_ring + p.cq_off.tail);
+	ring->cq_mask = (unsigned*)((char*)ring->cq_ring + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + p.cq_off.cqes);
+	ring->inflight = 0;
+	pthread_mutex_init(&ring->sq_lock, NULL);
+	pthread_mutex_init(&ring->cq_lock, NULL);
+	return 0;
+}
+
+/* Tears the ring down; nothing may be in flight
+* on it.
+*/
+void uring_exit(uring_t* ring)
+{
+	if ( ring->fd < 0 )
+		return;
+	munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+	if ( ring->cq_ring != ring->sq_ring )
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	ring->fd = -1;
+	pthread_mutex_destroy(&ring->sq_lock);
+	pthread_mutex_destroy(&ring->cq_lock);
+}
+
+// Transfers one page synchronously.
+static void sync_rw(const uring_io_t* io)
+{
+	if ( io->write )
+		pwrite(io->fd, io->buf, 4096, io->offset);
+	else
+		pread(io->fd, io->buf, 4096, io->offset);
+}
+
+/* Takes the finished transfers off the completion
+* ring and marks them done, redoing with
+* pread/pwrite one the ring failed or cut short.
+* With wait, and nothing to take, first waits for a
+* transfer to finish, unless until (if given) is
+* done already.  Returns false if it should have
+* waited but nothing was in flight yet.
+*/
+static bool reap(uring_t* ring, bool wait, const uring_io_t* until)
+{
+	struct io_uring_cqe* cqe;
+	uring_io_t* io;
+	unsigned head;
+	bool in_flight = true;
+	int ret;
+
+	pthread_mutex_lock(&ring->cq_lock);
+	head = *ring->cq_head;
+	if ( wait && (until == NULL || !__atomic_load_n(&until->done, __ATOMIC_ACQUIRE))
+		 && head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) )
+	{
+		in_flight = __atomic_load_n(&ring->inflight, __ATOMIC_ACQUIRE) > 0;
+		ret = in_flight ? (int)syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+									   IORING_ENTER_GETEVENTS, NULL, 0) : 0;
+		if ( ret < 0 && errno != EINTR )
+		{
+			perror("io_uring_enter");
+			exit(EXIT_FAILURE);
+		}
+	}
+	while ( head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) )
+	{
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		io = (uring_io_t*)(uintptr_t)cqe->user_data;
+		if ( cqe->res != 4096 && !(cqe->res == 0 && !io->write) )
+			sync_rw(io);
+		head++;
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+		__atomic_sub_fetch(&ring->inflight, 1, __ATOMIC_RELEASE);
+		// io may be gone as soon as it reads done.
+		__atomic_store_n(&io->done, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&ring->cq_lock);
+	return in_flight;
+}
+
+/* Starts reading (or writing) the n pages of ios
+* from (or to) file fd and returns without waiting
+* for them: see uring_wait.  They go to the kernel
+* a ring's worth at a time with a single system
+* call, so the device sees the whole batch at once,
+* while other threads keep submitting and reaping
+* their own.  Without a ring they are done right
+* away with pread/pwrite.
+*/
+void uring_submit(uring_t* ring, int fd, bool write, uring_io_t** ios, int n)
+{
+	struct io_uring_sqe* sqe;
+	unsigned tail, count, i;
+	int ret;
+
+	for ( i = 0; i < (unsigned)n; i++ )
+	{
+		ios[i]->fd = fd;
+		ios[i]->write = write;
+		__atomic_store_n(&ios[i]->done, 0, __ATOMIC_RELAXED);
+	}
+	if ( ring->fd < 0 )
+	{
+		for ( i = 0; i < (unsigned)n; i++ )
+		{
+			sync_rw(ios[i]);
+			__atomic_store_n(&ios[i]->done, 1, __ATOMIC_RELEASE);
+		}
+		return;
+	}
+
+	while ( n > 0 )
+	{
+		pthread_mutex_lock(&ring->sq_lock);
+		count = ring->entries - __atomic_load_n(&ring->inflight, __ATOMIC_ACQUIRE);
+		if ( count == 0 )
+		{
+			// Full: make room, waiting if need be.
+			pthread_mutex_unlock(&ring->sq_lock);
+			reap(ring, true, NULL);
+			continue;
+		}
+		if ( count > (unsigned)n )
+			count = (unsigned)n;
+		tail = *ring->sq_tail;
+		for ( i = 0; i < count; i++ )
+		{
+			sqe = &ring->sqes[(tail + i) & *ring->sq_mask];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+			sqe->fd = fd;
+			sqe->addr = (unsigned long)ios[i]->buf;
+			sqe->len = 4096;
+			sqe->off = ios[i]->offset;
+			sqe->user_data = (uintptr_t)ios[i];
+			ring->sq_array[(tail + i) & *ring->sq_mask] = (tail + i) & *ring->sq_mask;
+		}
+		__atomic_add_fetch(&ring->inflight, count, __ATOMIC_RELEASE);
+		__atomic_store_n(ring->sq_tail, tail + count, __ATOMIC_RELEASE);
+
+		/* An interrupted call is resumed with
+		* whatever the kernel has not taken from the
+		* submission ring yet.
+		*/
+		while ( tail + count != __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) )
+		{
+			ret = (int)syscall(__NR_io_uring_enter, ring->fd,
+							   tail + count - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE),
+							   0, 0, NULL, 0);
+			if ( ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY )
+			{
+				perror("io_uring_enter");
+				exit(EXIT_FAILURE);
+			}
+		}
+		pthread_mutex_unlock(&ring->sq_lock);
+		ios += count;
+		n -= count;
+	}
+}
+
+// Marks what has finished done, without waiting.
+void uring_reap(uring_t* ring)
+{
+	if ( ring->fd >= 0 )
+		reap(ring, false, NULL);
+}
+
+/* Returns once io is done.  Whichever waiter gets
+* to the completion ring first reaps for all of
+* them, so transfers submitted by different threads
+* are in flight together.  io may not have been
+* submitted yet, its owner being about to.
+*/
+void uring_wait(uring_t* ring, uring_io_t* io)
+{
+	while ( !__atomic_load_n(&io->done, __ATOMIC_ACQUIRE) )
+	{
+		if ( ring->fd < 0 || !reap(ring, true, io) )
+			sched_yield();
+	}
+}
+
+/* Reads (or writes) the n pages of ios from (or to)
+* file fd and returns once all of them are done.
+*/
+void uring_rw(uring_t* ring, int fd, bool write, uring_io_t* ios, int n)
+{
+	uring_io_t* batch[URING_ENTRIES];
+	int i, j, count;
+
+	for ( i = 0; i < n; i += count )
+	{
+		count = n - i < URING_ENTRIES ? n - i : URING_ENTRIES;
+		for ( j = 0; j < count; j++ )
+			batch[j] = &ios[i + j];
+		uring_submit(ring, fd, write, batch, count);
+	}
+	for ( i = 0; i < n; i++ )
+		uring_wait(ring, &ios[i]);
+}